@@ -0,0 +1,117 @@
+/*
+	Add and cancel cost of heap_timer against timer_wheel, not part of the library, it has its own main.
+	gcc -std=gnu99 -O2 bench/timer_wheel_bench.c tools/timer_wheel.c tools/heap_timer.c tools/heap_obj.c -o timer_wheel_bench
+
+	For each size the timers are added with random delays up to one minute, then
+	BENCH_CANCEL_NUM random ones are cancelled. ht_del_timer searches the heap, so
+	cancelling all of a million timers would take hours; the sample keeps the run short.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../tools/heap_timer.h"
+#include "../tools/timer_wheel.h"
+
+#define BENCH_CANCEL_NUM	10000
+#define BENCH_MAX_DELAY		60000
+
+static uint64_t s_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void s_on_timeout(uint32_t timer_id, void* user_data) {
+}
+
+//xorshift, the same sequence for both timers
+static uint32_t s_rand(uint32_t* state) {
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static int s_bench_heap(uint32_t num, uint32_t* ids, double* add_ns, double* del_ns) {
+	heap_timer_t* ht = ht_create_heap_timer();
+	if (ht == 0)
+		return -1;
+
+	uint32_t seed = 2463534242u;
+	uint64_t begin = s_now_ns();
+	for (uint32_t i = 0; i < num; ++i) {
+		ids[i] = ht_add_timer(ht, 1000, s_rand(&seed) % BENCH_MAX_DELAY + 1, 1, s_on_timeout, 0);
+		if (ids[i] == -1) {
+			ht_destroy_heap_timer(ht);
+			return -1;
+		}
+	}
+	*add_ns = (double)(s_now_ns() - begin) / num;
+
+	uint32_t cancel = num < BENCH_CANCEL_NUM ? num : BENCH_CANCEL_NUM;
+	begin = s_now_ns();
+	for (uint32_t i = 0; i < cancel; ++i) {
+		ht_del_timer(ht, ids[s_rand(&seed) % num]);
+	}
+	*del_ns = (double)(s_now_ns() - begin) / cancel;
+
+	ht_destroy_heap_timer(ht);
+	return 0;
+}
+
+static int s_bench_wheel(uint32_t num, uint32_t* ids, double* add_ns, double* del_ns) {
+	timer_wheel_t* tw = tw_create_timer_wheel();
+	if (tw == 0)
+		return -1;
+
+	uint32_t seed = 2463534242u;
+	uint64_t begin = s_now_ns();
+	for (uint32_t i = 0; i < num; ++i) {
+		ids[i] = tw_add_timer(tw, 1000, s_rand(&seed) % BENCH_MAX_DELAY + 1, 1, s_on_timeout, 0);
+		if (ids[i] == -1) {
+			tw_destroy_timer_wheel(tw);
+			return -1;
+		}
+	}
+	*add_ns = (double)(s_now_ns() - begin) / num;
+
+	uint32_t cancel = num < BENCH_CANCEL_NUM ? num : BENCH_CANCEL_NUM;
+	begin = s_now_ns();
+	for (uint32_t i = 0; i < cancel; ++i) {
+		tw_del_timer(tw, ids[s_rand(&seed) % num]);
+	}
+	*del_ns = (double)(s_now_ns() - begin) / cancel;
+
+	tw_destroy_timer_wheel(tw);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	static const uint32_t sizes[] = { 10000, 100000, 1000000 };
+
+	uint32_t* ids = (uint32_t*)malloc(sizeof(uint32_t) * sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+	if (ids == 0)
+		return 1;
+
+	printf("%-10s %-8s %14s %14s\n", "timers", "timer", "add ns/op", "cancel ns/op");
+	for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		double add_ns, del_ns;
+		if (s_bench_heap(sizes[i], ids, &add_ns, &del_ns)) {
+			printf("heap_timer of %u timers failed\n", sizes[i]);
+			break;
+		}
+		printf("%-10u %-8s %14.1f %14.1f\n", sizes[i], "heap", add_ns, del_ns);
+
+		if (s_bench_wheel(sizes[i], ids, &add_ns, &del_ns)) {
+			printf("timer_wheel of %u timers failed\n", sizes[i]);
+			break;
+		}
+		printf("%-10u %-8s %14.1f %14.1f\n", sizes[i], "wheel", add_ns, del_ns);
+	}
+
+	free(ids);
+	return 0;
+}
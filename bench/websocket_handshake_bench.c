@@ -0,0 +1,141 @@
+/*
+	Cost of the websocket server handshake, not part of the library, it has its own main.
+	The file includes the sources of the handshake to reach their static functions, link the others:
+	gcc -std=gnu99 -O2 -Inewnet -Itools bench/websocket_handshake_bench.c newnet/netio_buffer.c newnet/rbtree.c newnet/sock_reactor.c newnet/sock_session.c newnet/tcp_protocol.c
+		tools/basic_tools.c tools/heap_obj.c tools/heap_timer.c tools/timer_wheel.c -o websocket_handshake_bench -luuid -lpthread -lz
+	./websocket_handshake_bench > /dev/null		(the results go to stderr, the manager logs every session to stdout)
+
+	1. Sec-WebSocket-Accept per key, the portable SHA-1 and base64 against the ones picked at runtime
+	2. loopback handshakes against a manager in its own thread, the cpu time of that thread per handshake
+*/
+
+#include "../newnet/sha1.c"
+#include "../newnet/base64_encoder.c"
+#include "../newnet/websocket_protocol.c"
+
+#include <time.h>
+#include <pthread.h>
+
+#define BENCH_KEY_ROUNDS		2000000
+#define BENCH_HANDSHAKES		20000
+#define BENCH_PORT				17799
+
+static const char s_request[] = "GET /chat HTTP/1.1\r\nHost: server.example.com\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+	"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nOrigin: http://example.com\r\nSec-WebSocket-Version: 13\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\nAccept-Language: en-US,en;q=0.9\r\nCache-Control: no-cache\r\n\r\n";
+
+static uint64_t s_clock_ns(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static double s_accept_key_ns() {
+	char key[] = "dGhlIHNhbXBsZSBub25jZQ==";
+	char b64[32];
+	volatile char sink = 0;
+
+	uint64_t begin = s_clock_ns(CLOCK_MONOTONIC);
+	for (int i = 0; i < BENCH_KEY_ROUNDS; ++i) {
+		key[i & 15] ^= 1;
+		web_accept_key(key, sizeof(key) - 1, b64);
+		sink ^= b64[3];
+	}
+	return (double)(s_clock_ns(CLOCK_MONOTONIC) - begin) / BENCH_KEY_ROUNDS;
+}
+
+static void s_on_pkg(sock_session_t* ss, char* data, uint32_t len) {
+}
+
+static void s_stop(sock_manager_t* sm, void* user_data) {
+	sm_set_running(sm, 0);
+}
+
+static void* s_server_thread(void* p) {
+	sm_run((sock_manager_t*)p);
+	return 0;
+}
+
+//return the handshakes completed
+static int s_handshakes(int count) {
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(BENCH_PORT);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	int ok = 0;
+	char buf[512];
+	for (int i = 0; i < count; ++i) {
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd == -1)
+			break;
+		//reset instead of TIME_WAIT, the ports of the loop would run out
+		struct linger lin = { 1, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+		if (connect(fd, (struct sockaddr*)&sin, sizeof(sin)) == 0 && write(fd, s_request, sizeof(s_request) - 1) == sizeof(s_request) - 1) {
+			int len = read(fd, buf, sizeof(buf));
+			if (len > 12 && memcmp(buf, "HTTP/1.1 101", 12) == 0)
+				++ok;
+		}
+		close(fd);
+	}
+	return ok;
+}
+
+int main(int argc, char** argv) {
+	//the first call resolves the dispatch pointers
+	uint8_t digest[20];
+	char b64[32];
+	sz_sha1((const uint8_t*)"", 0, (char*)digest);
+	base64_encode(digest, sizeof(digest), b64);
+
+	void (*sha1_blocks)(uint32_t state[5], const uint8_t* data, size_t blocks) = s_sha1_blocks;
+	char* (*b64_encode)(const uint8_t*, int, char*) = s_base64_encode;
+
+	s_sha1_blocks = SHA1_Transform_blocks;
+	s_base64_encode = base64_encode_plain;
+	fprintf(stderr, "accept key, portable: %.1f ns\n", s_accept_key_ns());
+	s_sha1_blocks = sha1_blocks;
+	s_base64_encode = b64_encode;
+	fprintf(stderr, "accept key, runtime:  %.1f ns\n", s_accept_key_ns());
+
+	sock_manager_t* sm = sm_init_manager();
+	if (sm == 0)
+		return 1;
+	sm_set_write_first(sm, 1);
+	if (sm_add_defult_listen(sm, BENCH_PORT, 4096, PROTO_COMMU_WEBSOCKET_BINARY, 1, 0, 4096, 0, 4096, s_on_pkg, 0, 0, 0)) {
+		fprintf(stderr, "listen on port %d failed\n", BENCH_PORT);
+		sm_exit_manager(sm);
+		return 1;
+	}
+
+	pthread_t tid;
+	clockid_t server_clock;
+	sm_set_running(sm, 1);
+	if (pthread_create(&tid, 0, s_server_thread, sm)) {
+		sm_exit_manager(sm);
+		return 1;
+	}
+	pthread_getcpuclockid(tid, &server_clock);
+
+	//warm up the session pool and the buffers
+	s_handshakes(BENCH_HANDSHAKES / 10);
+
+	uint64_t cpu = s_clock_ns(server_clock);
+	uint64_t wall = s_clock_ns(CLOCK_MONOTONIC);
+	int ok = s_handshakes(BENCH_HANDSHAKES);
+	wall = s_clock_ns(CLOCK_MONOTONIC) - wall;
+	cpu = s_clock_ns(server_clock) - cpu;
+
+	while (sm_post_closure(sm, s_stop, 0)) {
+		usleep(1000);
+	}
+	pthread_join(tid, 0);
+	sm_exit_manager(sm);
+
+	fprintf(stderr, "handshakes: %d of %d, server cpu %.1f us each -> %.0f handshakes/s per core, %.0f/s wall\n",
+		ok, BENCH_HANDSHAKES, (double)cpu / ok / 1000, ok * 1000000000.0 / cpu, ok * 1000000000.0 / wall);
+	return ok == BENCH_HANDSHAKES ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+/*
+	web_mask_copy against the byte loop it replaced, not part of the library, it has its own main.
+	The file includes websocket_protocol.c to reach the static function, link the other sources:
+	gcc -std=gnu99 -O2 -Inewnet -Itools bench/websocket_mask_bench.c newnet/base64_encoder.c newnet/netio_buffer.c newnet/rbtree.c newnet/sha1.c newnet/sock_reactor.c
+		newnet/sock_session.c newnet/tcp_protocol.c tools/basic_tools.c tools/heap_obj.c tools/heap_timer.c tools/timer_wheel.c -o websocket_mask_bench -luuid -lpthread -lz
+
+	First compares both on random offsets, lengths, mask offsets and in place or copied data,
+	then prints the unmask throughput of a few payload sizes.
+*/
+
+#include "../newnet/websocket_protocol.c"
+
+#include <time.h>
+
+#define BENCH_CHECK_ROUNDS	200000
+#define BENCH_CHECK_MAX_LEN	1000
+#define BENCH_BYTES			(1u << 30)	//unmasked per payload size
+
+static uint64_t s_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void s_mask_bytes(const char* mask_arr, uint32_t mask_off, char* dst, const char* src, uint32_t data_len) {
+	for (uint32_t i = 0; i < data_len; ++i) {
+		dst[i] = src[i] ^ mask_arr[(mask_off + i) & 3];
+	}
+}
+
+static int s_check() {
+	static char src[BENCH_CHECK_MAX_LEN + 64], expect[BENCH_CHECK_MAX_LEN + 64], dst[BENCH_CHECK_MAX_LEN + 64];
+	srand(5);
+
+	for (int round = 0; round < BENCH_CHECK_ROUNDS; ++round) {
+		uint32_t src_off = rand() % 32, dst_off = rand() % 32, len = rand() % BENCH_CHECK_MAX_LEN, mask_off = rand();
+		int in_place = rand() & 1;
+		char mask[4];
+		for (int k = 0; k < 4; ++k) {
+			mask[k] = (char)rand();
+		}
+		for (int k = 0; k < sizeof(src); ++k) {
+			src[k] = (char)rand();
+		}
+		memcpy(expect, src, sizeof(src));
+		memcpy(dst, src, sizeof(src));
+
+		//bytes around the payload must stay untouched
+		if (in_place) {
+			s_mask_bytes(mask, mask_off, expect + src_off, src + src_off, len);
+			web_mask_copy(mask, mask_off, dst + src_off, dst + src_off, len);
+		}
+		else {
+			s_mask_bytes(mask, mask_off, expect + dst_off, src + src_off, len);
+			web_mask_copy(mask, mask_off, dst + dst_off, src + src_off, len);
+		}
+
+		if (memcmp(expect, dst, sizeof(dst))) {
+			printf("mismatch round: %d, src_off: %u, dst_off: %u, len: %u, mask_off: %u, in_place: %d\n", round, src_off, dst_off, len, mask_off, in_place);
+			return -1;
+		}
+	}
+	printf("%d random rounds match the byte loop\n", BENCH_CHECK_ROUNDS);
+	return 0;
+}
+
+static double s_throughput(int use_bytes, char* data, uint32_t len) {
+	const char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+	uint32_t rounds = BENCH_BYTES / len;
+
+	uint64_t begin = s_now_ns();
+	for (uint32_t i = 0; i < rounds; ++i) {
+		if (use_bytes)
+			s_mask_bytes(mask, 0, data, data, len);
+		else
+			web_mask_copy(mask, 0, data, data, len);
+		__asm__ volatile("" ::: "memory");
+	}
+	uint64_t spent = s_now_ns() - begin;
+	return (double)rounds * len / spent * 1000000000.0 / (1 << 20);
+}
+
+int main(int argc, char** argv) {
+	static const uint32_t sizes[] = { 16, 125, 1400, 65536, 1u << 24 };
+
+	if (s_check())
+		return 1;
+
+	//+1: the payload of a received frame rarely starts on an aligned address
+	char* buf = (char*)malloc((1u << 24) + 1);
+	if (buf == 0)
+		return 1;
+	memset(buf, 'x', (1u << 24) + 1);
+
+	printf("%-10s %14s %14s\n", "bytes", "byte MB/s", "mask MB/s");
+	for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		double bytes = s_throughput(1, buf + 1, sizes[i]);
+		double words = s_throughput(0, buf + 1, sizes[i]);
+		printf("%-10u %14.0f %14.0f\n", sizes[i], bytes, words);
+	}
+
+	free(buf);
+	return 0;
+}
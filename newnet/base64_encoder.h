@@ -9,7 +9,16 @@ extern "C"
 {
 #endif
 
-char* base64_encode(uint8_t* text, int sz, char* out_buf);
+//encoded length of @sz bytes, without the terminating 0
+#define BASE64_ENCODE_LEN(sz) (((sz) + 2) / 3 * 4)
+
+/**
+*	base64_encode - Encode @sz bytes of @text into @out_buf and terminate it, reentrant
+*	Blocks of 12 bytes are encoded with SSSE3 when the cpu has it.
+*	@out_buf: BASE64_ENCODE_LEN(@sz) + 1 bytes
+*	return @out_buf
+*/
+char* base64_encode(const uint8_t* text, int sz, char* out_buf);
 
 #ifdef __cplusplus
 }
@@ -7,32 +7,183 @@
 
 //#define netio_malloc malloc
 //#define netio_free	free
+
+/*
+	buffer pool
+*/
+
+//class of a length, -1 if it bypasses the pool
+static int s_pool_class(uint32_t length) {
+	if (length > (1u << NETIO_POOL_MAX_SHIFT))
+		return -1;
+	if (length <= (1u << NETIO_POOL_MIN_SHIFT))
+		return 0;
+	return (32 - __builtin_clz(length - 1)) - NETIO_POOL_MIN_SHIFT;
+}
+
+void netio_pool_init(netio_pool_t* pool) {
+	if (pool) {
+		memset(pool, 0, sizeof(netio_pool_t));
+		pool->cache_limit = NETIO_POOL_DEFAULT_LIMIT;
+	}
+}
+
+void netio_pool_destroy(netio_pool_t* pool) {
+	if (pool == 0)
+		return;
+
+	for (int i = 0; i < NETIO_POOL_CLASS_NUM; ++i) {
+		while (pool->free_list[i]) {
+			void* next = *(void**)pool->free_list[i];
+			free(pool->free_list[i]);
+			pool->free_list[i] = next;
+		}
+		pool->free_count[i] = 0;
+	}
+	pool->cached_bytes = 0;
+}
+
+char* netio_pool_alloc(netio_pool_t* pool, uint32_t length) {
+	if (length == 0)
+		return 0;
+
+	int idx = s_pool_class(length);
+	if (pool == 0 || idx == -1)
+		return (char*)malloc(length);
+
+	pool->alloc_count += 1;
+	if (pool->free_list[idx]) {
+		char* buf = (char*)pool->free_list[idx];
+		pool->free_list[idx] = *(void**)buf;
+		pool->free_count[idx] -= 1;
+		pool->cached_bytes -= 1u << (idx + NETIO_POOL_MIN_SHIFT);
+		pool->hit_count += 1;
+		return buf;
+	}
+	return (char*)malloc(1u << (idx + NETIO_POOL_MIN_SHIFT));
+}
+
+char* netio_pool_realloc(netio_pool_t* pool, char* buf, uint32_t length, uint32_t new_length) {
+	if (buf == 0)
+		return netio_pool_alloc(pool, new_length);
+
+	int idx = s_pool_class(length);
+	int new_idx = s_pool_class(new_length);
+	if (pool == 0 || (idx == -1 && new_idx == -1))
+		return (char*)realloc(buf, new_length);
+
+	//the class already has the room
+	if (idx == new_idx)
+		return buf;
+
+	char* new_buf = netio_pool_alloc(pool, new_length);
+	if (new_buf == 0)
+		return 0;
+
+	memcpy(new_buf, buf, length < new_length ? length : new_length);
+	netio_pool_free(pool, buf, length);
+	return new_buf;
+}
+
+void netio_pool_free(netio_pool_t* pool, char* buf, uint32_t length) {
+	if (buf == 0)
+		return;
+
+	int idx = s_pool_class(length);
+	if (pool == 0 || idx == -1 || pool->cached_bytes + (1u << (idx + NETIO_POOL_MIN_SHIFT)) > pool->cache_limit) {
+		free(buf);
+		return;
+	}
+
+	*(void**)buf = pool->free_list[idx];
+	pool->free_list[idx] = buf;
+	pool->free_count[idx] += 1;
+	pool->cached_bytes += 1u << (idx + NETIO_POOL_MIN_SHIFT);
+}
+
+int netio_pool_reserve(netio_pool_t* pool, uint32_t length, uint32_t count) {
+	int idx = s_pool_class(length);
+	if (pool == 0 || length == 0 || idx == -1)
+		return -1;
+
+	uint64_t size = 1u << (idx + NETIO_POOL_MIN_SHIFT);
+	if (pool->cached_bytes + size * count > pool->cache_limit)
+		pool->cache_limit = pool->cached_bytes + size * count;
+
+	//buffers already cached may belong to an earlier call for the same class
+	for (uint32_t i = 0; i < count; ++i) {
+		char* buf = (char*)malloc(size);
+		if (buf == 0)
+			return -1;
+		netio_pool_free(pool, buf, length);
+	}
+	return 0;
+}
+/*
+	shared data
+*/
+
+netio_shared_t* netio_shared_create(netio_pool_t* pool, uint32_t length) {
+	uint64_t alloc = sizeof(netio_shared_t) + (uint64_t)length;
+	if (alloc > 0xFFFFFFFF)
+		return 0;
+
+	netio_shared_t* sh = (netio_shared_t*)netio_pool_alloc(pool, (uint32_t)alloc);
+	if (sh == 0)
+		return 0;
+	sh->refcount = 1;
+	sh->length = length;
+	sh->alloc = (uint32_t)alloc;
+	sh->pool = pool;
+	sh->data = (char*)(sh + 1);
+	return sh;
+}
+
+void netio_shared_release(netio_shared_t* sh) {
+	if (sh && (sh->refcount -= 1) == 0)
+		netio_pool_free(sh->pool, (char*)sh, sh->alloc);
+}
+
 /*
 	为输入缓冲区提供内存
 */
 
-int netio_ibuf_init(neti_buffer_t* nb, uint32_t min_length, uint32_t max_length) {
+int netio_ibuf_init(neti_buffer_t* nb, uint32_t min_length, uint32_t max_length, netio_pool_t* pool) {
 	if (nb == 0 || min_length > max_length)
 		return -1;
 
 	memset(nb, 0, sizeof(neti_buffer_t));
+	nb->pool = pool;
 
 	nb->recv_buf_length = max_length;
+	nb->recv_buf_max = max_length;
+	return 0;
+}
 
-	if (max_length) {
-		//nb->recv_buf = (char*)netio_malloc(max_length);
-		nb->recv_buf = (char*)malloc(max_length);
+int netio_ibuf_acquire(neti_buffer_t* nb) {
+	if (nb == 0)
+		return -1;
 
+	if (nb->recv_buf == 0 && nb->recv_buf_length) {
+		nb->recv_buf = netio_pool_alloc(nb->pool, nb->recv_buf_length);
 		if (nb->recv_buf == 0)
 			return -1;
-		nb->recv_buf_max = max_length;
 	}
 	return 0;
 }
 
+void netio_ibuf_release(neti_buffer_t* nb) {
+	if (nb && nb->recv_buf && nb->recv_len == 0) {
+		netio_pool_free(nb->pool, nb->recv_buf, nb->recv_buf_length);
+		nb->recv_buf = 0;
+		nb->recv_off = 0;
+		nb->recv_idx = 0;
+	}
+}
+
 void netio_ibuf_destroy(neti_buffer_t* nb) {
 	if (nb && nb->recv_buf) {
-		free(nb->recv_buf);
+		netio_pool_free(nb->pool, nb->recv_buf, nb->recv_buf_length);
 		nb->recv_buf = 0;
 	}
 }
@@ -46,6 +197,34 @@ int netio_ibuf_check_full(neti_buffer_t* nb) {
 		return -1;
 	if ((nb->recv_buf_length - nb->recv_len) == 0)
 		return -1;
+	//the tail is used up, move the unparsed data once
+	if (netio_ibuf_unused_length(nb) == 0) {
+		memmove(nb->recv_buf, nb->recv_buf + nb->recv_off, nb->recv_len);
+		nb->recv_off = 0;
+	}
+	return 0;
+}
+
+int netio_ibuf_resize(neti_buffer_t* nb, uint32_t max_length) {
+	if (nb == 0 || nb->recv_len > max_length)
+		return -1;
+
+	if (nb->recv_buf && max_length != nb->recv_buf_length) {
+		if (nb->recv_off) {
+			memmove(nb->recv_buf, nb->recv_buf + nb->recv_off, nb->recv_len);
+			nb->recv_off = 0;
+		}
+
+		char* buf = max_length ? netio_pool_realloc(nb->pool, nb->recv_buf, nb->recv_buf_length, max_length) : 0;
+		if (buf == 0 && max_length)
+			return -1;
+		if (max_length == 0)
+			netio_pool_free(nb->pool, nb->recv_buf, nb->recv_buf_length);
+		nb->recv_buf = buf;
+	}
+
+	nb->recv_buf_length = max_length;
+	nb->recv_buf_max = max_length;
 	return 0;
 }
 
@@ -55,75 +234,157 @@ int netio_ibuf_check_full(neti_buffer_t* nb) {
 	retrun，成功:0 失败-1 错误指示: errno
 */
 
-int netio_obuf_init(neto_buffer_t* nb, uint32_t min_length, uint32_t max_length) {
+int netio_obuf_init(neto_buffer_t* nb, uint32_t min_length, uint32_t max_length, netio_pool_t* pool) {
 	if (nb == 0 || min_length > max_length)
 		return -1;
 
 	memset(nb, 0, sizeof(neto_buffer_t));
+	nb->pool = pool;
 
 	nb->send_buf_max = max_length;
-	
-
-	if (min_length) {
-		//nb->send_buf = (char*)netio_malloc(min_length);
-		nb->send_buf = (char*)malloc(min_length);
-
-		if (nb->send_buf == 0)
-			return -1;
-		nb->send_buf_length = min_length;
-	}
+	nb->send_buf_length = min_length < NETIO_OBUF_MIN_SEGMENT ? NETIO_OBUF_MIN_SEGMENT : min_length;
 	return 0;
 }
 
+static void s_obuf_free_segment(neto_buffer_t* nb, neto_segment_t* seg) {
+	netio_shared_release(seg->shared);
+	netio_pool_free(nb->pool, (char*)seg, seg->length);
+}
+
 void netio_obuf_destroy(neto_buffer_t* nb) {
-	if (nb && nb->send_buf) {
-		free(nb->send_buf);
-		nb->send_buf = 0;
+	if (nb == 0)
+		return;
+
+	while (nb->head) {
+		neto_segment_t* seg = nb->head;
+		nb->head = seg->next;
+		s_obuf_free_segment(nb, seg);
 	}
-		
+	nb->tail = 0;
+	nb->send_len = 0;
 }
 
+int netio_obuf_check_full(neto_buffer_t* nb, uint32_t output_len) {
+	if (nb == 0 || output_len > nb->send_buf_max)
+		return -1;
+
+	//若已有长度+待发送长度 > 队列最大长度
+	if ((uint64_t)nb->send_len + output_len > nb->send_buf_max)
+		return 1;
+	return 0;
+}
 
-//int netio_obuf_check_full(neto_buffer_t* nb, const char* output_data, uint32_t output_len, int* out_processed_length) {
-//
-//}
+int netio_obuf_append(neto_buffer_t* nb, const void* data, uint32_t length) {
+	return netio_obuf_append_copy(nb, data, length, 0, 0);
+}
 
-int netio_obuf_check_full(neto_buffer_t* nb, uint32_t output_len) {
+int netio_obuf_append_copy(neto_buffer_t* nb, const void* data, uint32_t length, void (*copy)(char*, const char*, uint32_t, uint32_t, void*), void* ctx) {
 	if (nb == 0)
 		return -1;
 
-	int all_len = nb->send_len + output_len;
+	const char* src = (const char*)data;
+	while (length) {
+		neto_segment_t* seg = nb->tail;
+		if (seg == 0 || seg->len == seg->cap) {
+			//the rest of a long message goes to one segment
+			uint64_t seg_len = sizeof(neto_segment_t) + (uint64_t)length;
+			if (seg_len < nb->send_buf_length)
+				seg_len = nb->send_buf_length;
+			if (seg_len > 0xFFFFFFFF)
+				seg_len = 0xFFFFFFFF;
 
-	//若已有长度+待发送长度 > 当前缓冲区长度
-	if (all_len > nb->send_buf_length) {
-		//若没有超过最大长度则尝试更换缓冲区,此处包含了0xffffffff的判断
-		if (all_len <= nb->send_buf_max) {
-			nb->send_buf = realloc(nb->send_buf, all_len);
-			if (nb->send_buf == 0) {
-				nb->send_buf_length = 0;
+			seg = (neto_segment_t*)netio_pool_alloc(nb->pool, (uint32_t)seg_len);
+			if (seg == 0)
 				return -1;
-			}
-			nb->send_buf_length = all_len;
-			return 0;
+			seg->next = 0;
+			seg->length = (uint32_t)seg_len;
+			seg->off = seg->len = 0;
+			seg->cap = seg->length - sizeof(neto_segment_t);
+			seg->data = (char*)(seg + 1);
+			seg->shared = 0;
 
-		}else {
-			//若大于最大长度两倍
-			if (all_len > (nb->send_buf_max * 2)) {
-				return -1;
-			}
-			//此处需要判断如果已经是最大值 则不需要再malloc
-			//char* new_buf = (char*)netio_malloc(nb->send_buf_max);
-			if (nb->send_buf_length < nb->send_buf_max) {
-				nb->send_buf = realloc(nb->send_buf, nb->send_buf_max);
-				if (nb->send_buf == 0) {
-					nb->send_buf_length = 0;
-					return -1;
-				}
-				nb->send_buf_length = nb->send_buf_max;
-			}
-			//若不大于两倍，则拷贝缓冲区剩余长度的数据到缓冲区，发送后再重试，若依旧为当前返回值，则关闭套接字
-			return 1;
+			if (nb->tail)
+				nb->tail->next = seg;
+			else
+				nb->head = seg;
+			nb->tail = seg;
 		}
+
+		uint32_t n = seg->cap - seg->len;
+		if (n > length)
+			n = length;
+		if (copy)
+			copy(seg->data + seg->len, src, n, src - (const char*)data, ctx);
+		else
+			memcpy(seg->data + seg->len, src, n);
+		seg->len += n;
+		nb->send_len += n;
+		src += n;
+		length -= n;
 	}
 	return 0;
-}
\ No newline at end of file
+}
+
+int netio_obuf_append_shared(neto_buffer_t* nb, netio_shared_t* sh) {
+	if (nb == 0 || sh == 0)
+		return -1;
+	if (sh->length == 0)
+		return 0;
+
+	//a full segment of its own, the next append opens a new one
+	neto_segment_t* seg = (neto_segment_t*)netio_pool_alloc(nb->pool, sizeof(neto_segment_t));
+	if (seg == 0)
+		return -1;
+	seg->next = 0;
+	seg->length = sizeof(neto_segment_t);
+	seg->off = 0;
+	seg->len = seg->cap = sh->length;
+	seg->data = sh->data;
+	seg->shared = sh;
+	netio_shared_retain(sh);
+
+	if (nb->tail)
+		nb->tail->next = seg;
+	else
+		nb->head = seg;
+	nb->tail = seg;
+	nb->send_len += sh->length;
+	return 0;
+}
+
+int netio_obuf_iov(neto_buffer_t* nb, struct iovec* iov, int iov_max, uint32_t* out_length) {
+	int cnt = 0;
+	uint32_t total = 0;
+	for (neto_segment_t* seg = nb->head; seg && cnt < iov_max; seg = seg->next) {
+		if (seg->len == seg->off)
+			continue;
+		iov[cnt].iov_base = seg->data + seg->off;
+		iov[cnt].iov_len = seg->len - seg->off;
+		total += seg->len - seg->off;
+		++cnt;
+	}
+
+	if (out_length)
+		*out_length = total;
+	return cnt;
+}
+
+void netio_obuf_drain(neto_buffer_t* nb, uint32_t length) {
+	nb->send_len -= length < nb->send_len ? length : nb->send_len;
+
+	while (nb->head) {
+		neto_segment_t* seg = nb->head;
+		uint32_t unsent = seg->len - seg->off;
+		if (length < unsent) {
+			seg->off += length;
+			return;
+		}
+
+		//finished, a fully sent tail is released too and the next append takes a new one
+		length -= unsent;
+		nb->head = seg->next;
+		if (nb->head == 0)
+			nb->tail = 0;
+		s_obuf_free_segment(nb, seg);
+	}
+}
@@ -2,24 +2,79 @@
 #define _NETIO_BUFFER_H_
 
 #include <stdint.h>
+#include <sys/uio.h>
+
+/*
+	Buffer pool with power of two size classes, from 1 << NETIO_POOL_MIN_SHIFT to 1 << NETIO_POOL_MAX_SHIFT.
+	A buffer of length L is allocated with the full size of class ceil(log2(L)), so the length recorded
+	by its owner always finds the class again. Longer buffers bypass the pool.
+	A buffer must be allocated, grown and released through the same pool (0 is plain malloc/free).
+	One pool per manager, single thread only.
+*/
+#define NETIO_POOL_MIN_SHIFT (6)				//64 bytes
+#define NETIO_POOL_MAX_SHIFT (20)				//1MB
+#define NETIO_POOL_CLASS_NUM (NETIO_POOL_MAX_SHIFT - NETIO_POOL_MIN_SHIFT + 1)
+#define NETIO_POOL_DEFAULT_LIMIT (64 << 20)		//bytes kept in the free lists
+
+typedef struct netio_pool {
+	void*			free_list[NETIO_POOL_CLASS_NUM];	//chained through the first bytes of the buffers
+	uint32_t		free_count[NETIO_POOL_CLASS_NUM];
+	uint64_t		cached_bytes;
+	uint64_t		cache_limit;
+	uint64_t		alloc_count;			//buffers handed out
+	uint64_t		hit_count;				//of them served from the free lists
+}netio_pool_t;
 
 //recv buffer
 typedef struct neti_buffer {
 	//	uint64_t		recv_prev_time;			//prev process time
 	//	uint32_t		recv_count;				//unit time recv count
-	uint32_t		recv_idx;				//processed data index
-	uint32_t		recv_len;				//received lenth
+	uint32_t		recv_off;				//start of the unparsed data, the parsers consume by moving it
+	uint32_t		recv_idx;				//processed data index, relative to recv_off
+	uint32_t		recv_len;				//received lenth, from recv_off
 	uint32_t		recv_buf_length;		//current input buffer length
 	uint32_t		recv_buf_max;			//recv buffer max length
 	char*			recv_buf;				//buffer
+	netio_pool_t*	pool;					//owner of recv_buf
 }neti_buffer_t;
 
-//send buffer
+#define NETIO_OBUF_MIN_SEGMENT (1024)			//smallest output segment, header included
+
+/*
+	immutable reference counted data, a message framed once and queued by many sessions.
+	Single thread like its pool, the last netio_shared_release frees it.
+*/
+typedef struct netio_shared {
+	uint32_t				refcount;
+	uint32_t				length;			//data length
+	uint32_t				alloc;			//length given to the pool
+	netio_pool_t*			pool;
+	char*					data;
+}netio_shared_t;
+
+//output segment, the data follows the header in the same pool buffer, or is a netio_shared_t
+typedef struct neto_segment {
+	struct neto_segment*	next;
+	uint32_t				length;			//length given to the pool
+	uint32_t				off;			//bytes already sent
+	uint32_t				len;			//bytes written
+	uint32_t				cap;			//room for data
+	char*					data;
+	netio_shared_t*			shared;			//referenced data, 0 if the segment owns it
+}neto_segment_t;
+
+/*
+	send queue, a chain of segments.
+	Appending never grows or moves the queued data, a partial send only moves the head offset,
+	and the sent segments go back to the pool.
+*/
 typedef struct neto_buffer {
-	uint32_t		send_len;				//to be send
-	uint32_t		send_buf_length;		//send buffer length
-	uint32_t		send_buf_max;			//send buffer max length
-	char*			send_buf;
+	uint32_t		send_len;				//to be send, all segments
+	uint32_t		send_buf_length;		//segment length
+	uint32_t		send_buf_max;			//send queue max length
+	neto_segment_t*	head;					//sent from
+	neto_segment_t*	tail;					//appended to
+	netio_pool_t*	pool;					//owner of the segments
 }neto_buffer_t;
 
 #ifdef __cplusplus
@@ -28,42 +83,140 @@ extern "C"
 #endif
 
 
-int netio_ibuf_init(neti_buffer_t* nb,uint32_t min_length, uint32_t max_length);
+void netio_pool_init(netio_pool_t* pool);
+
+void netio_pool_destroy(netio_pool_t* pool);
+
+/*
+	return a buffer of at least @length, or 0 for error
+*/
+char* netio_pool_alloc(netio_pool_t* pool, uint32_t length);
+
+/*
+	grow @buf of @length to @new_length, the data is kept, @buf stays valid on error
+	return the new buffer, or 0 for error
+*/
+char* netio_pool_realloc(netio_pool_t* pool, char* buf, uint32_t length, uint32_t new_length);
+
+/*
+	@length: the length the buffer was allocated or grown with
+*/
+void netio_pool_free(netio_pool_t* pool, char* buf, uint32_t length);
+
+/*
+	put @count buffers of @length in the free lists, the cache limit grows to keep them
+	return 0 success, or -1 for error
+*/
+int netio_pool_reserve(netio_pool_t* pool, uint32_t length, uint32_t count);
+
+/*
+	return a buffer of @length with refcount 1, the caller fills data before queuing it
+	return 0 for error
+*/
+netio_shared_t* netio_shared_create(netio_pool_t* pool, uint32_t length);
+
+static inline void netio_shared_retain(netio_shared_t* sh) {
+	sh->refcount += 1;
+}
+
+void netio_shared_release(netio_shared_t* sh);
+
+/*
+	the input buffer is lazy, init only records the lengths,
+	netio_ibuf_acquire gets the memory when data arrives and netio_ibuf_release gives it back once everything is consumed
+*/
+int netio_ibuf_init(neti_buffer_t* nb,uint32_t min_length, uint32_t max_length, netio_pool_t* pool);
+
+/*
+	return 0 success, or -1 for error
+*/
+int netio_ibuf_acquire(neti_buffer_t* nb);
+
+void netio_ibuf_release(neti_buffer_t* nb);
 
 void netio_ibuf_destroy(neti_buffer_t* nb);
 
+/*
+	moves the unparsed data back to the start only when the free tail is used up
+	return 0 there is room for recv, -1 the unparsed data fills the buffer
+*/
 int netio_ibuf_check_full(neti_buffer_t* nb);
 
+/*
+	change the length of the input buffer, the unparsed data moves to its front
+	return 0, or -1 the data does not fit or no memory
+*/
+int netio_ibuf_resize(neti_buffer_t* nb, uint32_t max_length);
+
+//unparsed data, recv_len bytes
+static inline char* netio_ibuf_data(neti_buffer_t* nb) {
+	return nb->recv_buf + nb->recv_off;
+}
+
 static char* netio_ibuf_breakpoint(neti_buffer_t* nb) {
-	return nb->recv_buf + nb->recv_len;
+	return nb->recv_buf + nb->recv_off + nb->recv_len;
 }
 
 static uint32_t netio_ibuf_unused_length(neti_buffer_t* nb) {
-	return nb->recv_buf_length - nb->recv_len;
+	return nb->recv_buf_length - nb->recv_off - nb->recv_len;
 }
 
-int netio_obuf_init(neto_buffer_t* nb, uint32_t min_length, uint32_t max_length);
+/*
+	drop @length parsed bytes from the front, no copy
+	recv_idx keeps pointing at the same byte
+*/
+static inline void netio_ibuf_consume(neti_buffer_t* nb, uint32_t length) {
+	nb->recv_off += length;
+	nb->recv_len -= length;
+	nb->recv_idx = nb->recv_idx > length ? nb->recv_idx - length : 0;
+	if (nb->recv_len == 0)
+		nb->recv_off = 0;
+}
 
+/*
+	the output buffer is lazy too, @min_length is the segment length (at least NETIO_OBUF_MIN_SEGMENT),
+	@max_length bounds the queued data
+*/
+int netio_obuf_init(neto_buffer_t* nb, uint32_t min_length, uint32_t max_length, netio_pool_t* pool);
+
+//drop the queued data, the segments go back to the pool
 void netio_obuf_destroy(neto_buffer_t* nb);
 
 /*
 	return val: 
-	-1: Parameter error, memory allocation failure, length more than twice the buffer
-	 0: Buffer can hold
-	 1: If the length to be sent is greater than the maximum length but less than twice the maximum length, the caller can copy part of it to the buffer and try to send it immediately,
-		and then verify it again until the return value is 0, or close it in advance
+	-1: Parameter error, the length is more than the max length of the queue
+	 0: Queue can hold
+	 1: The queued data leaves no room, the caller can try to send it immediately and verify it again, or close it in advance
 */
-
-//int netio_obuf_check_full(neto_buffer_t* nb, const char* output_data, uint32_t output_len, int* out_processed_length);
 int netio_obuf_check_full(neto_buffer_t* nb, uint32_t output_len);
 
-static char* netio_obuf_breakpoint(neto_buffer_t* nb) {
-	return nb->send_buf + nb->send_len;
-}
+/*
+	copy @length bytes to the tail, new segments are taken from the pool when the tail is full
+	return 0 success, or -1 for error (a part may have been queued)
+*/
+int netio_obuf_append(neto_buffer_t* nb, const void* data, uint32_t length);
 
-static uint32_t netio_obuf_unused_length(neto_buffer_t* nb) {
-	return nb->send_buf_length - nb->send_len;
-}
+/*
+	netio_obuf_append with @copy(dst, src, n, offset of src in @data, @ctx) instead of memcpy,
+	for data transformed on the way in (the masked payload of a websocket client)
+*/
+int netio_obuf_append_copy(neto_buffer_t* nb, const void* data, uint32_t length, void (*copy)(char*, const char*, uint32_t, uint32_t, void*), void* ctx);
+
+/*
+	fill @iov with the unsent data from the head, at most @iov_max entries
+	@out_length: bytes described by @iov
+	return the number of entries
+*/
+int netio_obuf_iov(neto_buffer_t* nb, struct iovec* iov, int iov_max, uint32_t* out_length);
+
+/*
+	queue a reference to @sh, its data is not copied
+	return 0 success, or -1 for error
+*/
+int netio_obuf_append_shared(neto_buffer_t* nb, netio_shared_t* sh);
+
+//@length bytes were sent, release the finished segments
+void netio_obuf_drain(neto_buffer_t* nb, uint32_t length);
 
 #ifdef __cplusplus
 }
@@ -86,6 +86,19 @@ A million repetitions of "a"
 #include <string.h>
 #include <stdint.h>
 
+#include "sha1.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <cpuid.h>
+#define SHA1_X86
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define SHA1_ARMV8
+#endif
+
 typedef struct {
 	uint32_t state[5];
 	uint32_t count[2];
@@ -171,6 +184,172 @@ static void	SHA1_Transform(uint32_t	state[5], const	uint8_t	buffer[64])
 }
 
 
+/*
+	Hardware transforms, @blocks blocks of 64 bytes from @data.
+	SHA-NI (x86) and the ARMv8 crypto extension keep the state in registers between the blocks,
+	the widest one the cpu supports is picked on the first call.
+*/
+static void SHA1_Transform_blocks(uint32_t state[5], const uint8_t* data, size_t blocks)
+{
+	for (; blocks; --blocks, data += 64) {
+		SHA1_Transform(state, data);
+	}
+}
+
+#ifdef SHA1_X86
+/* cpuid: SSE4.1 (leaf 1 ecx) and SHA (leaf 7 ebx) */
+static int s_cpu_has_shani(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0 || (ecx & bit_SSE4_1) == 0)
+		return 0;
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0)
+		return 0;
+	return (ebx & bit_SHA) != 0;
+}
+
+/* one group of 4 rounds, @m0 is its message, the next messages are expanded on the way */
+#define SHA1_NI_ROUNDS(e0, e1, m0, m1, m2, m3, f) \
+	e0 = _mm_sha1nexte_epu32(e0, m0); \
+	e1 = abcd; \
+	m1 = _mm_sha1msg2_epu32(m1, m0); \
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, f); \
+	m3 = _mm_sha1msg1_epu32(m3, m0); \
+	m2 = _mm_xor_si128(m2, m0);
+
+__attribute__((target("sha,sse4.1")))
+static void SHA1_Transform_shani(uint32_t state[5], const uint8_t* data, size_t blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1, msg0, msg1, msg2, msg3;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B);
+	e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+	for (; blocks; --blocks, data += 64) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		/* Rounds 0-15, the message words are loaded */
+		msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), bswap);
+		e0 = _mm_add_epi32(e0, msg0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), bswap);
+		e1 = _mm_sha1nexte_epu32(e1, msg1);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+		msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), bswap);
+		e0 = _mm_sha1nexte_epu32(e0, msg2);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+		msg0 = _mm_xor_si128(msg0, msg2);
+
+		msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), bswap);
+		SHA1_NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 0);
+
+		/* Rounds 16-75 */
+		SHA1_NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 0);
+		SHA1_NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1);
+		SHA1_NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 1);
+		SHA1_NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 1);
+		SHA1_NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 1);
+		SHA1_NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1);
+		SHA1_NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2);
+		SHA1_NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 2);
+		SHA1_NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 2);
+		SHA1_NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 2);
+		SHA1_NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2);
+		SHA1_NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 3);
+		SHA1_NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 3);
+		SHA1_NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 3);
+		SHA1_NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 3);
+
+		/* Rounds 76-79 */
+		e1 = _mm_sha1nexte_epu32(e1, msg3);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	_mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = _mm_extract_epi32(e0, 3);
+}
+#endif//SHA1_X86
+
+#ifdef SHA1_ARMV8
+__attribute__((target("+crypto")))
+static void SHA1_Transform_armv8(uint32_t state[5], const uint8_t* data, size_t blocks)
+{
+	static const uint32_t k[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+	uint32x4_t abcd = vld1q_u32(state);
+	uint32_t e = state[4];
+
+	for (; blocks; --blocks, data += 64) {
+		uint32x4_t abcd_save = abcd, msg[4], tmp[2];
+		uint32_t e_save = e;
+		int g;
+
+		for (g = 0; g < 4; ++g) {
+			msg[g] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + g * 16)));
+		}
+		tmp[0] = vaddq_u32(msg[0], vdupq_n_u32(k[0]));
+		tmp[1] = vaddq_u32(msg[1], vdupq_n_u32(k[0]));
+
+		/* 20 groups of 4 rounds, the message of group g + 3 is expanded during group g */
+		for (g = 0; g < 20; ++g) {
+			uint32_t e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+			if (g < 5)
+				abcd = vsha1cq_u32(abcd, e, tmp[g & 1]);
+			else if (g < 10 || g >= 15)
+				abcd = vsha1pq_u32(abcd, e, tmp[g & 1]);
+			else
+				abcd = vsha1mq_u32(abcd, e, tmp[g & 1]);
+			e = e_next;
+
+			if (g < 18)
+				tmp[g & 1] = vaddq_u32(msg[(g + 2) & 3], vdupq_n_u32(k[(g + 2) / 5]));
+			if (g >= 1 && g <= 16)
+				msg[(g + 3) & 3] = vsha1su1q_u32(msg[(g + 3) & 3], msg[(g + 2) & 3]);
+			if (g <= 15)
+				msg[g & 3] = vsha1su0q_u32(msg[g & 3], msg[(g + 1) & 3], msg[(g + 2) & 3]);
+		}
+
+		abcd = vaddq_u32(abcd, abcd_save);
+		e += e_save;
+	}
+
+	vst1q_u32(state, abcd);
+	state[4] = e;
+}
+#endif//SHA1_ARMV8
+
+static void SHA1_Transform_init(uint32_t state[5], const uint8_t* data, size_t blocks);
+static void (*s_sha1_blocks)(uint32_t state[5], const uint8_t* data, size_t blocks) = SHA1_Transform_init;
+
+static void SHA1_Transform_init(uint32_t state[5], const uint8_t* data, size_t blocks)
+{
+	//every thread stores the same pointer
+	void (*transform)(uint32_t*, const uint8_t*, size_t) = SHA1_Transform_blocks;
+#ifdef SHA1_X86
+	if (s_cpu_has_shani())
+		transform = SHA1_Transform_shani;
+#endif//SHA1_X86
+#ifdef SHA1_ARMV8
+	if (getauxval(AT_HWCAP) & HWCAP_SHA1)
+		transform = SHA1_Transform_armv8;
+#endif//SHA1_ARMV8
+	__atomic_store_n(&s_sha1_blocks, transform, __ATOMIC_RELAXED);
+	transform(state, data, blocks);
+}
+
+
 /* SHA1Init	- Initialize new context */
 static void sat_SHA1_Init(SHA1_CTX* context)
 {
@@ -198,9 +377,10 @@ static void sat_SHA1_Update(SHA1_CTX* context, const uint8_t* data, const size_t
 	context->count[1] += (len >> 29);
 	if ((j + len) >	63)	{
 		memcpy(&context->buffer[j], data, (i = 64 - j));
-		SHA1_Transform(context->state, context->buffer);
-		for (; i + 63 < len; i += 64) {
-			SHA1_Transform(context->state, data + i);
+		s_sha1_blocks(context->state, context->buffer, 1);
+		if (len - i >= 64) {
+			s_sha1_blocks(context->state, data + i, (len - i) >> 6);
+			i += (len - i) & ~(size_t)63;
 		}
 		j = 0;
 	}
@@ -223,10 +403,9 @@ static void sat_SHA1_Final(SHA1_CTX* context, uint8_t digest[SHA1_DIGEST_SIZE])
 		finalcount[i] = (unsigned char)((context->count[(i >= 4 ? 0 : 1)]
 			>> ((3 - (i & 3)) * 8)) & 255);	 /*	Endian independent */
 	}
-	sat_SHA1_Update(context, (uint8_t *)"\200", 1);
-	while ((context->count[0] & 504) != 448) {
-		sat_SHA1_Update(context, (uint8_t *)"\0", 1);
-	}
+	/* 0x80, zeros up to 56 mod 64, in one update */
+	static const uint8_t padding[64] = { 0x80 };
+	sat_SHA1_Update(context, padding, 1 + ((119 - ((context->count[0] >> 3) & 63)) & 63));
 	sat_SHA1_Update(context, finalcount, 8);  /* Should	cause a	SHA1_Transform() */
 	for (i = 0; i < SHA1_DIGEST_SIZE; i++) {
 		digest[i] = (uint8_t)
@@ -241,13 +420,13 @@ static void sat_SHA1_Final(SHA1_CTX* context, uint8_t digest[SHA1_DIGEST_SIZE])
 	memset(finalcount, 0, 8);	/* SWR */
 }
 
-char* sz_sha1(uint8_t* buffer, int sz, char* out_buf) {
+char* sz_sha1(const uint8_t* buffer, int sz, char* out_buf) {
 	//static uint8_t digest[SHA1_DIGEST_SIZE];
 	SHA1_CTX ctx;
 	sat_SHA1_Init(&ctx);
 	sat_SHA1_Update(&ctx, buffer, sz);
 	//sat_SHA1_Final(&ctx, digest);
-	sat_SHA1_Final(&ctx, out_buf);
+	sat_SHA1_Final(&ctx, (uint8_t*)out_buf);
 	//memcpy(out_buf, digest, SHA1_DIGEST_SIZE);
 	return out_buf;
 }
\ No newline at end of file
@@ -8,7 +8,13 @@ extern "C"
 {
 #endif
 
-char* sz_sha1(uint8_t* buffer, int sz, char* out_buf);
+/**
+*	sz_sha1 - SHA-1 digest of @buffer, reentrant
+*	SHA-NI or the ARMv8 crypto extension is used when the cpu has it.
+*	@out_buf: 20 bytes
+*	return @out_buf
+*/
+char* sz_sha1(const uint8_t* buffer, int sz, char* out_buf);
 
 #ifdef __cplusplus
 }
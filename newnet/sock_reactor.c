@@ -0,0 +1,246 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		//pthread_setaffinity_np
+#endif
+
+#include "sock_reactor.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "../tools/basic_tools.h"
+
+typedef struct sock_reactor {
+	sock_manager_t*			sm;
+	pthread_t				tid;
+	uint32_t				idx;
+	uint8_t					started;
+	sock_reactor_group_t*	group;
+}sock_reactor_t;
+
+typedef struct sock_reactor_group {
+	uint32_t		reactor_num;
+	uint8_t			pin_cpu;
+	uint8_t			running;
+	sock_reactor_t*	reactors;
+}sock_reactor_group_t;
+
+//posted to the mailbox, runs in the reactor thread so manager flags are never written by two threads
+static void s_reactor_stop(sock_manager_t* sm, void* p) {
+	sm_set_running(sm, 0);
+}
+
+static void* s_reactor_thread(void* p) {
+	sock_reactor_t* sr = (sock_reactor_t*)p;
+
+	if (sr->group->pin_cpu) {
+		long cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+		if (cpu_num > 0) {
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(sr->idx % cpu_num, &cpus);
+			if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+				printf("[%s] [%s:%d] [%s] Pin reactor: [%d] to cpu: [%ld] errmsg: [failed]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, sr->idx, sr->idx % cpu_num);
+		}
+	}
+
+	sm_run(sr->sm);
+	return 0;
+}
+
+sock_reactor_group_t* srg_init_group(uint32_t reactor_num, uint8_t pin_cpu) {
+	if (reactor_num == 0) {
+		long cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+		reactor_num = cpu_num > 0 ? cpu_num : 1;
+	}
+
+	sock_reactor_group_t* srg = (sock_reactor_group_t*)malloc(sizeof(sock_reactor_group_t));
+	if (srg == 0)
+		return 0;
+	memset(srg, 0, sizeof(sock_reactor_group_t));
+
+	srg->reactors = (sock_reactor_t*)malloc(sizeof(sock_reactor_t) * reactor_num);
+	if (srg->reactors == 0)
+		goto srg_init_group_failed;
+	memset(srg->reactors, 0, sizeof(sock_reactor_t) * reactor_num);
+
+	srg->pin_cpu = pin_cpu;
+	for (; srg->reactor_num < reactor_num; ++srg->reactor_num) {
+		sock_reactor_t* sr = &srg->reactors[srg->reactor_num];
+		sr->idx = srg->reactor_num;
+		sr->group = srg;
+		sr->sm = sm_init_manager();
+		if (sr->sm == 0)
+			goto srg_init_group_failed;
+		sm_set_reuseport(sr->sm, 1);
+	}
+	return srg;
+
+srg_init_group_failed:
+	srg_exit_group(srg);
+	return 0;
+}
+
+void srg_exit_group(sock_reactor_group_t* srg) {
+	if (srg == 0)
+		return;
+
+	srg_stop(srg);
+
+	if (srg->reactors) {
+		for (uint32_t i = 0; i < srg->reactor_num; ++i) {
+			sm_exit_manager(srg->reactors[i].sm);
+		}
+		free(srg->reactors);
+	}
+	free(srg);
+}
+
+uint32_t srg_size(sock_reactor_group_t* srg) {
+	if (srg)
+		return srg->reactor_num;
+	return 0;
+}
+
+sock_manager_t* srg_get_manager(sock_reactor_group_t* srg, uint32_t idx) {
+	if (srg == 0 || idx >= srg->reactor_num)
+		return 0;
+	return srg->reactors[idx].sm;
+}
+
+int srg_add_defult_listen(sock_reactor_group_t* srg, uint16_t listen_port, uint32_t max_listen, session_proto_commu_t proto_commu, uint8_t enable_et,
+	uint32_t client_min_recv_len, uint32_t client_max_recv_len, uint32_t client_min_send_len, uint32_t client_max_send_len,
+	void (*client_on_complate_pkg_cb)(sock_session_t*, char*, uint32_t),
+	void (*client_on_create_event_cb)(sock_session_t*),
+	void (*client_on_disconn_event_cb)(sock_session_t*),
+	void* user_data) {
+	if (srg == 0 || srg->running)
+		return -1;
+
+	//one SO_REUSEPORT listener per reactor
+	for (uint32_t i = 0; i < srg->reactor_num; ++i) {
+		int ret = sm_add_defult_listen(srg->reactors[i].sm, listen_port, max_listen, proto_commu, enable_et,
+			client_min_recv_len, client_max_recv_len, client_min_send_len, client_max_send_len,
+			client_on_complate_pkg_cb, client_on_create_event_cb, client_on_disconn_event_cb, user_data);
+		if (ret) {
+			//all reactors or none
+			while (i--)
+				sm_del_listen(srg->reactors[i].sm, listen_port);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int srg_add_diy_listen(sock_reactor_group_t* srg, uint16_t listen_port, uint32_t max_listen, uint8_t enable_et,
+	uint32_t client_min_recv_len, uint32_t client_max_recv_len, uint32_t client_min_send_len, uint32_t client_max_send_len,
+	void (*client_on_protocol_recv_cb)(sock_session_t*),
+	int (*client_on_protocol_send_cb)(sock_session_t*, const char*, unsigned int),
+	void (*client_on_protocol_ping_cb)(sock_session_t*),
+	void (*client_on_complate_pkg_cb)(sock_session_t*, char*, uint32_t),
+	void (*client_on_create_event_cb)(sock_session_t*),
+	void (*client_on_disconn_event_cb)(sock_session_t*),
+	void* user_data) {
+	if (srg == 0 || srg->running)
+		return -1;
+
+	for (uint32_t i = 0; i < srg->reactor_num; ++i) {
+		int ret = sm_add_diy_listen(srg->reactors[i].sm, listen_port, max_listen, enable_et,
+			client_min_recv_len, client_max_recv_len, client_min_send_len, client_max_send_len,
+			client_on_protocol_recv_cb, client_on_protocol_send_cb, client_on_protocol_ping_cb,
+			client_on_complate_pkg_cb, client_on_create_event_cb, client_on_disconn_event_cb, user_data);
+		if (ret) {
+			//all reactors or none
+			while (i--)
+				sm_del_listen(srg->reactors[i].sm, listen_port);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int srg_set_listen_heart(sock_reactor_group_t* srg, uint16_t listen_port, uint32_t ping_interval, uint32_t ping_timeout) {
+	if (srg == 0 || srg->running)
+		return -1;
+
+	for (uint32_t i = 0; i < srg->reactor_num; ++i) {
+		if (sm_set_listen_heart(srg->reactors[i].sm, listen_port, ping_interval, ping_timeout))
+			return -1;
+	}
+	return 0;
+}
+
+int srg_set_listen_deflate(sock_reactor_group_t* srg, uint16_t listen_port, uint8_t window_bits, uint8_t no_context_takeover, uint32_t mem_cap, uint32_t threshold) {
+	if (srg == 0 || srg->running)
+		return -1;
+
+	for (uint32_t i = 0; i < srg->reactor_num; ++i) {
+		if (sm_set_listen_deflate(srg->reactors[i].sm, listen_port, window_bits, no_context_takeover, mem_cap, threshold))
+			return -1;
+	}
+	return 0;
+}
+
+int srg_add_websocket_route(sock_reactor_group_t* srg, uint16_t listen_port, const char* path, session_proto_commu_t proto_commu,
+	uint32_t client_min_recv_len, uint32_t client_max_recv_len, uint32_t client_min_send_len, uint32_t client_max_send_len,
+	void (*client_on_complate_pkg_cb)(sock_session_t*, char*, uint32_t),
+	void (*client_on_create_event_cb)(sock_session_t*),
+	void (*client_on_disconn_event_cb)(sock_session_t*),
+	void* user_data) {
+	if (srg == 0 || srg->running)
+		return -1;
+
+	for (uint32_t i = 0; i < srg->reactor_num; ++i) {
+		if (sm_add_websocket_route(srg->reactors[i].sm, listen_port, path, proto_commu, client_min_recv_len, client_max_recv_len, client_min_send_len, client_max_send_len,
+			client_on_complate_pkg_cb, client_on_create_event_cb, client_on_disconn_event_cb, user_data)) {
+			//a retry would find the path routed on the reactors before
+			while (i--)
+				sm_del_websocket_route(srg->reactors[i].sm, listen_port, path);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int srg_start(sock_reactor_group_t* srg) {
+	if (srg == 0 || srg->running)
+		return -1;
+
+	srg->running = ~0;
+	for (uint32_t i = 0; i < srg->reactor_num; ++i) {
+		sock_reactor_t* sr = &srg->reactors[i];
+		sm_set_running(sr->sm, 1);
+		if (pthread_create(&sr->tid, 0, s_reactor_thread, sr)) {
+			printf("[%s] [%s:%d] [%s] Start reactor: [%d] errmsg: [%s]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, i, strerror(errno));
+			srg_stop(srg);
+			return -1;
+		}
+		sr->started = ~0;
+	}
+	return 0;
+}
+
+void srg_stop(sock_reactor_group_t* srg) {
+	if (srg == 0 || srg->running == 0)
+		return;
+
+	//wake up every loop, it leaves sm_run after the command
+	for (uint32_t i = 0; i < srg->reactor_num; ++i) {
+		sock_reactor_t* sr = &srg->reactors[i];
+		if (sr->started == 0)
+			continue;
+		//the join below never returns if the loop misses the command
+		while (sm_post_closure(sr->sm, s_reactor_stop, 0)) {
+			printf("[%s] [%s:%d] [%s] Stop reactor: [%d] errmsg: [%s], retry\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, i, strerror(errno));
+			usleep(1000);
+		}
+	}
+
+	for (uint32_t i = 0; i < srg->reactor_num; ++i) {
+		sock_reactor_t* sr = &srg->reactors[i];
+		if (sr->started) {
+			pthread_join(sr->tid, 0);
+			sr->started = 0;
+		}
+	}
+	srg->running = 0;
+}
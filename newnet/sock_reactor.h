@@ -0,0 +1,111 @@
+#ifndef _SOCK_REACTOR_H_
+#define _SOCK_REACTOR_H_
+
+#include "sock_session.h"
+
+/**
+*	Multi-reactor mode
+*	One sock_manager_t per thread, every thread runs its own sm_run loop.
+*	Listeners are added to all managers with SO_REUSEPORT, the kernel spreads the accepts,
+*	and an accepted session belongs to the manager whose listener accepted it (see sm_session_manager).
+*	Sessions and timers of a manager must only be touched inside its own thread, other threads use the sm_post_* commands.
+*/
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct sock_reactor_group;
+typedef struct sock_reactor_group sock_reactor_group_t;
+
+/**
+*	srg_init_group - Create a reactor group
+*	@reactor_num: number of managers(threads), 0 is the number of online cpu
+*	@pin_cpu: pin the thread of reactor N to cpu (N % cpu count) (0/~0)
+*	return the new group, or 0 for error
+*/
+sock_reactor_group_t* srg_init_group(uint32_t reactor_num, uint8_t pin_cpu);
+
+/**
+*	srg_exit_group - Stop all reactor threads and destruction every manager
+*/
+void srg_exit_group(sock_reactor_group_t* srg);
+
+/**
+*	srg_size - Get the number of reactors
+*/
+uint32_t srg_size(sock_reactor_group_t* srg);
+
+/**
+*	srg_get_manager - Get the manager of reactor @idx
+*	return manager, or 0 for error
+*/
+sock_manager_t* srg_get_manager(sock_reactor_group_t* srg, uint32_t idx);
+
+/**
+*	srg_add_defult_listen - Add a default protocol listener to every reactor, see sm_add_defult_listen
+*	return 0 success, or -1 for error
+*/
+int srg_add_defult_listen(sock_reactor_group_t* srg, uint16_t listen_port, uint32_t max_listen, session_proto_commu_t proto_commu, uint8_t enable_et,
+	uint32_t client_min_recv_len, uint32_t client_max_recv_len, uint32_t client_min_send_len, uint32_t client_max_send_len,
+	void (*client_on_complate_pkg_cb)(sock_session_t*, char*, uint32_t),
+	void (*client_on_create_event_cb)(sock_session_t*),
+	void (*client_on_disconn_event_cb)(sock_session_t*),
+	void* user_data);
+
+/**
+*	srg_add_diy_listen - Add a diy protocol listener to every reactor, see sm_add_diy_listen
+*	return 0 success, or -1 for error
+*/
+int srg_add_diy_listen(sock_reactor_group_t* srg, uint16_t listen_port, uint32_t max_listen, uint8_t enable_et,
+	uint32_t client_min_recv_len, uint32_t client_max_recv_len, uint32_t client_min_send_len, uint32_t client_max_send_len,
+	void (*client_on_protocol_recv_cb)(sock_session_t*),
+	int (*client_on_protocol_send_cb)(sock_session_t*, const char*, unsigned int),
+	void (*client_on_protocol_ping_cb)(sock_session_t*),
+	void (*client_on_complate_pkg_cb)(sock_session_t*, char*, uint32_t),
+	void (*client_on_create_event_cb)(sock_session_t*),
+	void (*client_on_disconn_event_cb)(sock_session_t*),
+	void* user_data);
+
+/**
+*	srg_set_listen_heart - Idle check of a listener on every reactor, see sm_set_listen_heart
+*	Not rolled back: the reactors before one without the listener are already changed, repeating the call is safe.
+*	return 0 success, or -1 a reactor has no listener on @listen_port
+*/
+int srg_set_listen_heart(sock_reactor_group_t* srg, uint16_t listen_port, uint32_t ping_interval, uint32_t ping_timeout);
+
+/**
+*	srg_set_listen_deflate - permessage-deflate of a websocket listener on every reactor, see sm_set_listen_deflate
+*	Not rolled back: the reactors before one without the listener are already changed, repeating the call is safe.
+*	return 0 success, or -1 a reactor has no listener on @listen_port or a bad @window_bits (nothing changed)
+*/
+int srg_set_listen_deflate(sock_reactor_group_t* srg, uint16_t listen_port, uint8_t window_bits, uint8_t no_context_takeover, uint32_t mem_cap, uint32_t threshold);
+
+/**
+*	srg_add_websocket_route - Route a path of a websocket listener on every reactor, see sm_add_websocket_route
+*	return 0 success, or -1 for error
+*/
+int srg_add_websocket_route(sock_reactor_group_t* srg, uint16_t listen_port, const char* path, session_proto_commu_t proto_commu,
+	uint32_t client_min_recv_len, uint32_t client_max_recv_len, uint32_t client_min_send_len, uint32_t client_max_send_len,
+	void (*client_on_complate_pkg_cb)(sock_session_t*, char*, uint32_t),
+	void (*client_on_create_event_cb)(sock_session_t*),
+	void (*client_on_disconn_event_cb)(sock_session_t*),
+	void* user_data);
+
+/**
+*	srg_start - Start one thread per reactor, each thread runs sm_run
+*	return 0 success, or -1 for error (the threads already started are stopped)
+*/
+int srg_start(sock_reactor_group_t* srg);
+
+/**
+*	srg_stop - Ask every reactor to leave sm_run and wait for the threads
+*/
+void srg_stop(sock_reactor_group_t* srg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//_SOCK_REACTOR_H_
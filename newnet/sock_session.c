@@ -1,9 +1,113 @@
 #include "sock_session.h"
 #include "netio_buffer.h"
 
-#include "../tools/heap_timer.h"
+#include <sys/eventfd.h>
+#include <limits.h>
+
+#ifdef SM_ENABLE_IO_URING
+#include <poll.h>
+#include <liburing.h>
+#endif//SM_ENABLE_IO_URING
+
+#include "rbtree.h"
+#include "../tools/timer_wheel.h"
 #include "../tools/basic_tools.h"
 
+#define MAX_MAILBOX_BATCH (1024)
+#ifndef IOV_MAX
+#define IOV_MAX (1024)					//UIO_MAXIOV of linux, limits.h only has it with _XOPEN_SOURCE
+#endif
+#define MAX_SEND_IOV (IOV_MAX)			//output segments in one sendmsg
+#define MAX_IDLE_WHEEL_SIZE (64)		//seconds, power of 2
+#define MAX_HANDLE_NIL ((uint32_t)-1)
+#define MIN_WEBSOCK_ROUTE_BUCKET (16)	//hash buckets of a new router, power of 2
+#define WEB_DEFLATE_BITS_NUM (WEB_DEFLATE_MAX_BITS - WEB_DEFLATE_MIN_BITS + 1)
+//plain frames per protocol, then the compressed websocket frames per opcode and window
+#define MAX_BROADCAST_FRAMES (PROTO_COMMU_DIY + 2 * WEB_DEFLATE_BITS_NUM)
+
+/**
+*	sock_session_slab_t - Session objects are allocated by slab and never freed before sm_exit_manager
+*/
+typedef struct sock_session_slab {
+	struct sock_session_slab*	next;
+	sock_session_t				sessions[MAX_SESSION_SLAB];
+}sock_session_slab_t;
+
+/**
+*	sock_ops_node_t - A callback table of the manager, see s_session_ops
+*/
+typedef struct sock_ops_node {
+	struct sock_ops_node*	next;
+	sock_session_ops_t		ops;
+}sock_ops_node_t;
+
+/**
+*	sock_websock_router_t - Websocket routes of a listener, see sm_add_websocket_route
+*	The sessions it accepts run with @pending_ops (no create and disconnect callbacks) until the handshake picks their route.
+*	@routes: hash buckets of the paths, @route_mask + 1 of them
+*	@def: service of the listener, for the paths without a route
+*/
+typedef struct sock_websock_router {
+	struct sock_websock_router*	next;		//routers of the manager
+	websock_protocol_t**		routes;
+	uint32_t					route_mask;
+	uint32_t					route_num;
+	const sock_session_ops_t*	pending_ops;
+	websock_protocol_t*			def;
+}sock_websock_router_t;
+
+/**
+*	sock_handle_t - Slot of the handle table, a handle is (gen << 32 | index)
+*	@gen: bumped when the session is released, never 0 so no handle is 0
+*	@next: next free slot, MAX_HANDLE_NIL for none
+*/
+typedef struct sock_handle {
+	sock_session_t*		ss;
+	uint32_t			gen;
+	uint32_t			next;
+}sock_handle_t;
+
+/**
+*	sock_group_t - Node of the group tree, the members are a plain array
+*	@busy: a broadcast walks the members, the group is released after it
+*/
+typedef struct sock_group {
+	struct rb_node		rb_node;
+	uint32_t			group_id;
+	uint32_t			busy;
+	uint32_t			member_num;
+	uint32_t			member_cap;
+	sock_session_t**	members;
+}sock_group_t;
+
+//a group of a session and its index in the members
+typedef struct sock_group_ref {
+	sock_group_t*		group;
+	uint32_t			idx;
+}sock_group_ref_t;
+
+typedef enum sock_command_type {
+	SOCK_CMD_SEND,
+	SOCK_CMD_CLOSE,
+	SOCK_CMD_BROADCAST,
+	SOCK_CMD_CLOSURE,
+}sock_command_type_t;
+
+/**
+*	sock_command_t - Node of the cross-thread mailbox
+*	@handle: handle of the target session, resolved in the loop thread, a released session does not match
+*/
+typedef struct sock_command {
+	struct sock_command*	next;
+	sock_command_type_t		type;
+	uint64_t				handle;
+	uint32_t				delay_destruction;
+	void (*closure)(sock_manager_t*, void*);
+	void*					user_data;
+	uint32_t				data_len;
+	char					data[0];
+}sock_command_t;
+
 typedef struct sock_manager {
 	list_head_t list_online;
 	list_head_t list_offline;
@@ -11,10 +115,52 @@ typedef struct sock_manager {
 	list_head_t list_listens;
 	list_head_t list_pending_recv;
 	list_head_t list_pending_send;
-
-	heap_timer_t* ht_timer;
+	list_head_t list_dirty;
+
+	//idle deadlines of the online sessions, one slot per second, the heart timer only visits the due slot
+	list_head_t idle_wheel[MAX_IDLE_WHEEL_SIZE];
+	uint64_t idle_time;
+
+	//session pool, the free objects are chained by elem_online
+	sock_session_slab_t* slab_head;
+	list_head_t list_free_sessions;
+	uint32_t session_total;
+	uint32_t session_free;
+	uint64_t session_slabs;
+	//I/O buffers of the sessions
+	netio_pool_t buf_pool;
+
+	//callback tables shared by the sessions
+	sock_ops_node_t* ops_head;
+	//websocket routes of the listeners
+	sock_websock_router_t* router_head;
+
+	//session handles, the free slots are chained by next
+	sock_handle_t* handles;
+	uint32_t handle_cap;
+	uint32_t handle_free;
+
+	//groups by group_id, see sm_group_join
+	struct rb_root group_root;
+
+	timer_wheel_t* tw_timer;
 	int ep_fd;
 	manager_flag_t mng_flag;
+	sock_id_strategy_t id_strategy;
+
+	//lock-free MPSC command queue, other threads push, the loop drains on the eventfd wakeup
+	sock_session_t* mailbox_ss;
+	int mailbox_signaled;
+	sock_command_t* mailbox_head;
+	sock_command_t* mailbox_tail;
+	sock_command_t mailbox_stub;
+
+#ifdef SM_ENABLE_IO_URING
+	//io_uring backend, null when the manager uses epoll
+	struct io_uring* uring;
+	struct io_uring_buf_ring* uring_br;
+	char* uring_bufs;
+#endif//SM_ENABLE_IO_URING
 
 	log_level_t loglevel;
 	void* user_data;
@@ -22,48 +168,215 @@ typedef struct sock_manager {
 	void (*on_log)(log_level_t, char[512], void*);
 }sock_manager_t;
 
+#ifdef SM_ENABLE_IO_URING
+static int s_uring_add_event(sock_manager_t* sm, sock_session_t* ss, unsigned int epoll_event);
+static int s_uring_del_event(sock_manager_t* sm, sock_session_t* ss, unsigned int epoll_event);
+static void s_uring_send(sock_session_t* ss);
+#endif//SM_ENABLE_IO_URING
+
+static void s_leave_groups(sock_session_t* ss);
+static sock_session_t* s_add_client_session(sock_manager_t* sm, int fd, const char* ip, uint16_t port, session_proto_commu_t proto_commu, uint8_t enable_et, uint8_t add_online,
+	uint32_t min_recv_len, uint32_t max_recv_len, uint32_t min_send_len, uint32_t max_send_len, const sock_session_ops_t* ops, const sock_session_t* ls, void* user_data);
+
 typedef enum CREATE_SOCKFD_CTL {
 	CREATE_SOCK_SOCKET,
 	CREATE_SOCK_ACCPTE,
 }CREATE_SOCKFD_CTL_ENUM;
 
 /**
-*	s_cache_session - Get a session object and initialization I/O buffer
+*	s_grow_sessions - Add a slab of free session objects
 */
-static sock_session_t* s_cache_session(sock_manager_t* sm, uint32_t min_recv_len, uint32_t max_recv_len, uint32_t min_send_len, uint32_t max_send_len) {
-	int ret_flag = 0;
-	sock_session_t* ss = (sock_session_t*)malloc(sizeof(sock_session_t));
-	if (ss) {
-		memset(ss, 0, sizeof(sock_session_t));
+static int s_grow_sessions(sock_manager_t* sm) {
+	//the sessions start on a cache line
+	sock_session_slab_t* slab = 0;
+	if (posix_memalign((void**)&slab, SM_CACHE_LINE, sizeof(sock_session_slab_t)))
+		return -1;
 
-		ss->fd = -1;
+	slab->next = sm->slab_head;
+	sm->slab_head = slab;
+	for (int i = 0; i < MAX_SESSION_SLAB; ++i) {
+		list_add_tail(&slab->sessions[i].elem_online, &sm->list_free_sessions);
+	}
+	sm->session_total += MAX_SESSION_SLAB;
+	sm->session_free += MAX_SESSION_SLAB;
+	sm->session_slabs += 1;
+	return 0;
+}
 
-		if (netio_ibuf_init(&(ss->i_buf), min_recv_len, max_recv_len))
-			ret_flag = 1;
-		if(netio_obuf_init(&(ss->o_buf), min_send_len, max_send_len))
-			ret_flag = 1;
+static void s_destroy_sessions(sock_manager_t* sm) {
+	while (sm->slab_head) {
+		sock_session_slab_t* next = sm->slab_head->next;
+		free(sm->slab_head);
+		sm->slab_head = next;
+	}
+	INIT_LIST_HEAD(&sm->list_free_sessions);
+	sm->session_total = sm->session_free = 0;
+
+	if (sm->handles)
+		free(sm->handles);
+	sm->handles = 0;
+	sm->handle_cap = 0;
+	sm->handle_free = MAX_HANDLE_NIL;
+
+	while (sm->ops_head) {
+		sock_ops_node_t* next = sm->ops_head->next;
+		free(sm->ops_head);
+		sm->ops_head = next;
+	}
 
-		if (ret_flag) {
-			netio_ibuf_destroy(&(ss->i_buf));
-			netio_obuf_destroy(&(ss->o_buf));
-			free(ss);
-			return 0;
+	while (sm->router_head) {
+		sock_websock_router_t* router = sm->router_head;
+		for (uint32_t i = 0; i <= router->route_mask; ++i) {
+			while (router->routes[i]) {
+				websock_protocol_t* next = router->routes[i]->next;
+				free(router->routes[i]);
+				router->routes[i] = next;
+			}
 		}
+		sm->router_head = router->next;
+		free(router->routes);
+		free(router->def);
+		free(router);
+	}
+}
+
+static const sock_session_ops_t s_empty_ops;
+
+/**
+*	s_session_ops - Get the callback table of the manager equal to @ops, add a copy if there is none
+*	The tables live until sm_exit_manager, a manager only has a few (one per protocol and listener).
+*/
+static const sock_session_ops_t* s_session_ops(sock_manager_t* sm, const sock_session_ops_t* ops) {
+	sock_ops_node_t* node;
+	for (node = sm->ops_head; node; node = node->next) {
+		if (memcmp(&node->ops, ops, sizeof(sock_session_ops_t)) == 0)
+			return &node->ops;
+	}
+
+	node = (sock_ops_node_t*)malloc(sizeof(sock_ops_node_t));
+	if (node == 0)
+		return 0;
+	node->ops = *ops;
+	node->next = sm->ops_head;
+	sm->ops_head = node;
+	return &node->ops;
+}
+
+/**
+*	s_protocol_ops - Fill the protocol callbacks of the built-in @proto_commu, PROTO_COMMU_DIY is left as is
+*/
+static void s_protocol_ops(session_proto_commu_t proto_commu, sock_session_ops_t* ops) {
+	switch (proto_commu) {
+	case PROTO_COMMU_TCP_BINARY:
+		ops->on_protocol_recv_cb = tcp_binary_protocol_recv;
+		ops->on_protocol_send_cb = tcp_binary_protocol_send;
+		ops->on_protocol_ping_cb = tcp_binary_protocol_ping;
+		break;
+	case PROTO_COMMU_TCP_JSON:
+		ops->on_protocol_recv_cb = tcp_json_protocol_recv;
+		ops->on_protocol_send_cb = tcp_json_protocol_send;
+		ops->on_protocol_ping_cb = tcp_json_protocol_ping;
+		break;
+	case PROTO_COMMU_WEBSOCKET_BINARY:
+	case PROTO_COMMU_WEBSOCKET_JSON:
+		ops->on_protocol_recv_cb = web_protocol_recv;
+		ops->on_protocol_send_cb = web_protocol_send;
+		ops->on_protocol_ping_cb = web_protocol_ping;
+		break;
+	default:
+		break;
+	}
+}
 
-		INIT_LIST_HEAD(&ss->elem_online);
-		INIT_LIST_HEAD(&ss->elem_offline);
-		INIT_LIST_HEAD(&ss->elem_servers);
-		INIT_LIST_HEAD(&ss->elem_listens);
-		INIT_LIST_HEAD(&ss->elem_pending_recv);
-		INIT_LIST_HEAD(&ss->elem_pending_send);
+/**
+*	s_alloc_handle - Bind a handle slot to @ss, the table doubles when no slot is free
+*/
+static int s_alloc_handle(sock_manager_t* sm, sock_session_t* ss) {
+	if (sm->handle_free == MAX_HANDLE_NIL) {
+		if (sm->handle_cap >= MAX_HANDLE_NIL >> 1)
+			return -1;
 
+		uint32_t cap = sm->handle_cap ? sm->handle_cap << 1 : MAX_SESSION_SLAB;
+		sock_handle_t* handles = (sock_handle_t*)realloc(sm->handles, sizeof(sock_handle_t) * cap);
+		if (handles == 0)
+			return -1;
 
-		return ss;
+		for (uint32_t i = cap; i > sm->handle_cap; --i) {
+			handles[i - 1].ss = 0;
+			handles[i - 1].gen = 1;
+			handles[i - 1].next = sm->handle_free;
+			sm->handle_free = i - 1;
+		}
+		sm->handles = handles;
+		sm->handle_cap = cap;
 	}
 
+	uint32_t idx = sm->handle_free;
+	sock_handle_t* h = &sm->handles[idx];
+	sm->handle_free = h->next;
+	h->ss = ss;
+	ss->handle = ((uint64_t)h->gen << 32) | idx;
 	return 0;
 }
 
+static void s_free_handle(sock_manager_t* sm, sock_session_t* ss) {
+	if (ss->handle == 0)
+		return;
+
+	uint32_t idx = (uint32_t)ss->handle;
+	sock_handle_t* h = &sm->handles[idx];
+	h->ss = 0;
+	if (++h->gen == 0)
+		h->gen = 1;
+	h->next = sm->handle_free;
+	sm->handle_free = idx;
+	ss->handle = 0;
+}
+
+/**
+*	s_cache_session - Get a session object and initialization I/O buffer
+*/
+static sock_session_t* s_cache_session(sock_manager_t* sm, uint32_t min_recv_len, uint32_t max_recv_len, uint32_t min_send_len, uint32_t max_send_len) {
+	int ret_flag = 0;
+	if (list_empty(&sm->list_free_sessions) && s_grow_sessions(sm))
+		return 0;
+
+	sock_session_t* ss = list_first_entry(&sm->list_free_sessions, sock_session_t, elem_online);
+	list_del(&ss->elem_online);
+	sm->session_free -= 1;
+
+	memset(ss, 0, sizeof(sock_session_t));
+
+	ss->fd = -1;
+	ss->ops = &s_empty_ops;
+
+	if (netio_ibuf_init(&(ss->i_buf), min_recv_len, max_recv_len, &sm->buf_pool))
+		ret_flag = 1;
+	if(netio_obuf_init(&(ss->o_buf), min_send_len, max_send_len, &sm->buf_pool))
+		ret_flag = 1;
+	if (ret_flag == 0 && s_alloc_handle(sm, ss))
+		ret_flag = 1;
+
+	if (ret_flag) {
+		netio_ibuf_destroy(&(ss->i_buf));
+		netio_obuf_destroy(&(ss->o_buf));
+		list_add(&ss->elem_online, &sm->list_free_sessions);
+		sm->session_free += 1;
+		return 0;
+	}
+
+	INIT_LIST_HEAD(&ss->elem_online);
+	INIT_LIST_HEAD(&ss->elem_offline);
+	INIT_LIST_HEAD(&ss->elem_servers);
+	INIT_LIST_HEAD(&ss->elem_listens);
+	INIT_LIST_HEAD(&ss->elem_pending_recv);
+	INIT_LIST_HEAD(&ss->elem_pending_send);
+	INIT_LIST_HEAD(&ss->elem_dirty);
+	INIT_LIST_HEAD(&ss->elem_idle);
+
+	return ss;
+}
+
 /**
 *	s_free_session - Recover session object
 */
@@ -75,12 +388,24 @@ static void s_free_session(sock_manager_t* sm, sock_session_t* ss) {
 	list_del_init(&ss->elem_listens);
 	list_del_init(&ss->elem_pending_recv);
 	list_del_init(&ss->elem_pending_send);
+	list_del_init(&ss->elem_dirty);
+	list_del_init(&ss->elem_idle);
+
+	//listeners are released without s_del_session
+	if (ss->groups)
+		s_leave_groups(ss);
 
 	netio_ibuf_destroy(&(ss->i_buf));
 	netio_obuf_destroy(&(ss->o_buf));
-	free(ss);
-	
-	//You can try caching objects for reuse
+	if (ss->web_deflate || ss->web_client)
+		web_protocol_release(ss);
+
+	//every handle of the session goes stale here
+	s_free_handle(sm, ss);
+
+	//back to the pool, the most recent object is reused first
+	list_add(&ss->elem_online, &sm->list_free_sessions);
+	sm->session_free += 1;
 }
 
 /**
@@ -137,14 +462,20 @@ static void s_construction_session(sock_manager_t* sm, sock_session_t*ss, int fd
 
 	unsigned int len = strlen(ip);
 	if (len > 31) { len = 31; }
-	strncpy(ss->ip, ip, len + 1);
+	strncpy(ss->info.ip, ip, len + 1);
 
-	ss->port = port;
+	ss->info.port = port;
 	ss->last_active = time(0);
 	ss->destruction_time = -1;
+	ss->ping_interval = MAX_HEART_TIMEOUT;
+	ss->ping_timeout = MAX_HEART_TIMEOUT;
 
-	tools_get_uuid_r(ss->uuid);
-	ss->uuid_hash = tools_hash_func(ss->uuid, -1);
+	//the uuid string is left to sm_session_uuid
+	if (sm->id_strategy == SOCK_ID_UUID)
+		tools_get_random_id(ss->info.id);
+	else
+		tools_get_fast_id(ss->info.id);
+	ss->info.uuid_hash = tools_hash_id(ss->info.id);
 
 	ss->manager_ptr = sm;
 	ss->user_data = user_data;
@@ -155,16 +486,89 @@ static void s_construction_session(sock_manager_t* sm, sock_session_t*ss, int fd
 		tools_set_nonblocking(fd);
 	}
 }
+/**
+*	s_find_group - Search the group tree
+*	@link: if not 0, gets the link and the parent for an insertion when the group is missing
+*/
+static sock_group_t* s_find_group(sock_manager_t* sm, uint32_t group_id, struct rb_node*** link, struct rb_node** parent) {
+	struct rb_node** p = &sm->group_root.rb_node;
+	struct rb_node* prev = 0;
+	while (*p) {
+		sock_group_t* g = rb_entry(*p, sock_group_t, rb_node);
+		prev = *p;
+		if (group_id < g->group_id)
+			p = &(*p)->rb_left;
+		else if (group_id > g->group_id)
+			p = &(*p)->rb_right;
+		else
+			return g;
+	}
+
+	if (link) {
+		*link = p;
+		*parent = prev;
+	}
+	return 0;
+}
+
+static void s_free_group(sock_manager_t* sm, sock_group_t* g) {
+	rb_erase(&g->rb_node, &sm->group_root);
+	free(g->members);
+	free(g);
+}
+
+/**
+*	s_group_remove - Remove the member of @ref, the last member takes its place
+*/
+static void s_group_remove(sock_manager_t* sm, sock_group_ref_t* ref) {
+	sock_group_t* g = ref->group;
+	uint32_t idx = ref->idx;
+
+	g->member_num -= 1;
+	if (idx != g->member_num) {
+		sock_session_t* last = g->members[g->member_num];
+		g->members[idx] = last;
+		for (uint16_t i = 0; i < last->group_num; ++i) {
+			if (last->groups[i].group == g) {
+				last->groups[i].idx = idx;
+				break;
+			}
+		}
+	}
+
+	if (g->member_num == 0 && g->busy == 0)
+		s_free_group(sm, g);
+}
+
+/**
+*	s_leave_groups - A closed session leaves all its groups
+*/
+static void s_leave_groups(sock_session_t* ss) {
+	for (uint16_t i = 0; i < ss->group_num; ++i)
+		s_group_remove(ss->manager_ptr, &ss->groups[i]);
+
+	free(ss->groups);
+	ss->groups = 0;
+	ss->group_num = ss->group_cap = 0;
+}
 
 static void s_del_session(sock_session_t* ss, uint32_t delay_destruction) {
 	if (ss) {
 		ss->flag.bit_closed = ~0;
 		ss->manager_ptr->mng_flag.bit_closed = ~0;
 
+		if (ss->groups)
+			s_leave_groups(ss);
+
 		ss->i_buf.recv_len = 0;
 		ss->i_buf.recv_idx = 0;
+		ss->i_buf.recv_off = 0;
 
-		ss->o_buf.send_len = 0;
+#ifdef SM_ENABLE_IO_URING
+		//the kernel still reads the segments of a send in flight, its completion releases them
+		if (ss->uring_send_len == 0)
+#endif//SM_ENABLE_IO_URING
+		netio_obuf_destroy(&ss->o_buf);
 
 		if (delay_destruction) {
 			if (delay_destruction == -1)
@@ -183,9 +587,16 @@ static void s_del_session(sock_session_t* ss, uint32_t delay_destruction) {
 		//if in write pending
 		if (list_empty(&ss->elem_pending_send) == 0)
 			list_del_init(&ss->elem_pending_send);
-
-		if (ss->on_disconn_event_cb) {
-			ss->on_disconn_event_cb(ss);
+		//if waiting for the coalesced flush
+		if (list_empty(&ss->elem_dirty) == 0)
+			list_del_init(&ss->elem_dirty);
+		//no more idle check
+		if (list_empty(&ss->elem_idle) == 0)
+			list_del_init(&ss->elem_idle);
+
+		//a routed websocket session is created for the application only when its handshake completes, see sm_add_websocket_route
+		if (ss->ops->on_disconn_event_cb && (ss->web_router == 0 || ss->flag.bit_web_handshake)) {
+			ss->ops->on_disconn_event_cb(ss);
 		}
 	}
 }
@@ -212,9 +623,12 @@ static int s_reconnect_server(sock_session_t* ss) {
 		return -1;
 
 	sin.sin_family = AF_INET;
-	sin.sin_port = htons(ss->port);
-	sin.sin_addr.s_addr = inet_addr(ss->ip);
+	sin.sin_port = htons(ss->info.port);
+	sin.sin_addr.s_addr = inet_addr(ss->info.ip);
 
+	//like s_construction_session, ET reads until EAGAIN
+	if (ss->flag.bit_etmod)
+		tools_set_nonblocking(fd);
 	ss->fd = fd;
 	ret = connect(ss->fd, (const struct sockaddr*) & sin, sizeof(sin));
 
@@ -228,11 +642,17 @@ static int s_reconnect_server(sock_session_t* ss) {
 	else {
 		ret = sm_ep_add_event(ss->manager_ptr, ss, EPOLLIN);
 		if (ret) {
-			printf("[%s] [%s:%d] [%s] Add event failed, ip: [%s], port: [%d] errmsg: [%s]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->ip, ss->port, strerror(errno));
+			printf("[%s] [%s:%d] [%s] Add event failed, ip: [%s], port: [%d] errmsg: [%s]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, strerror(errno));
 			return -1;
 		}
 			
 		ss->flag.bit_closed = 0;
+
+		//a websocket client upgrades every new connection
+		if (ss->web_client && web_protocol_connect(ss)) {
+			ss->flag.bit_closed = ~0;
+			return -1;
+		}
 	}
 	return 0;
 }
@@ -241,20 +661,43 @@ static int s_reconnect_server(sock_session_t* ss) {
 	timer callback
 */
 
-//heart callback
+/**
+*	s_idle_schedule - Move the session to the slot of its idle deadline
+*/
+static void s_idle_schedule(sock_session_t* ss, uint64_t deadline) {
+	ss->idle_deadline = deadline;
+	list_move_tail(&ss->elem_idle, &ss->manager_ptr->idle_wheel[deadline & (MAX_IDLE_WHEEL_SIZE - 1)]);
+}
+
+//heart callback, runs every second and only touches the sessions whose deadline is due
 static void cb_on_heart_timeout(uint32_t timer_id, void* p) {
 	sock_manager_t* sm = (sock_manager_t*)p;
 
 	uint64_t cur_t = time(0);
 
+	//seconds missed by a busy loop are caught up, one round of the wheel covers every slot
+	if (cur_t - sm->idle_time > MAX_IDLE_WHEEL_SIZE)
+		sm->idle_time = cur_t - MAX_IDLE_WHEEL_SIZE;
+
 	sock_session_t* pos, * n;
-	list_for_each_entry_safe(pos, n, &sm->list_online, elem_online) {
-		if ((cur_t - pos->last_active) > MAX_HEART_TIMEOUT) {
-			if (pos->flag.bit_ping == 0 && pos->on_protocol_ping_cb) {
-				pos->on_protocol_ping_cb(pos);
+	while (sm->idle_time < cur_t) {
+		sm->idle_time += 1;
+		list_head_t* slot = &sm->idle_wheel[sm->idle_time & (MAX_IDLE_WHEEL_SIZE - 1)];
+
+		list_for_each_entry_safe(pos, n, slot, elem_idle) {
+			//deadline of a later round
+			if (pos->idle_deadline > cur_t)
+				continue;
+
+			if (pos->flag.bit_ping == 0 && pos->ops->on_protocol_ping_cb) {
+				pos->ops->on_protocol_ping_cb(pos);
+				if (pos->flag.bit_closed)
+					continue;
+				//wait for the pong, or try again later if the ping did not fit the send buffer
+				s_idle_schedule(pos, cur_t + (pos->flag.bit_ping ? pos->ping_timeout : pos->ping_interval));
 			}
 			else {
-				printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [on heart time out]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, pos->ip, pos->port);
+				printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [on heart time out]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, pos->info.ip, pos->info.port);
 				sm_del_session(pos, pos->flag.bit_is_server ? -1 : 0);
 			}
 		}
@@ -284,7 +727,7 @@ static void cb_on_reconnection_timeout(uint32_t timer_id, void* p) {
 			else {
 				ret = s_reconnect_server(pos);
 				if (ret == 0)
-					printf("[%s] [%s:%d] [%s], ip: [%s], port: [%d], info: [ reconnect success ]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, pos->ip, pos->port);
+					printf("[%s] [%s:%d] [%s], ip: [%s], port: [%d], info: [ reconnect success ]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, pos->info.ip, pos->info.port);
 			}
 		}
 	}
@@ -296,6 +739,11 @@ static void cb_on_reconnection_timeout(uint32_t timer_id, void* p) {
 */
 
 int sm_ep_add_event(struct sock_manager* sm, struct sock_session* ss, unsigned int epoll_event) {
+#ifdef SM_ENABLE_IO_URING
+	if (sm->uring)
+		return s_uring_add_event(sm, ss, epoll_event);
+#endif//SM_ENABLE_IO_URING
+
 	//If the monitor status exists except for the ET flag
 	if ((ss->epoll_state & (~(EPOLLET))) & epoll_event) {
 		return 0;
@@ -319,6 +767,11 @@ int sm_ep_add_event(struct sock_manager* sm, struct sock_session* ss, unsigned i
 int sm_ep_del_event(struct sock_manager* sm, struct sock_session* ss, unsigned int epoll_event) {
 	if (!((ss->epoll_state & (~(EPOLLET))) & epoll_event)) { return 0; }
 
+#ifdef SM_ENABLE_IO_URING
+	if (sm->uring)
+		return s_uring_del_event(sm, ss, epoll_event);
+#endif//SM_ENABLE_IO_URING
+
 	struct epoll_event epev;
 	epev.data.ptr = ss;
 	int ctl = EPOLL_CTL_DEL;
@@ -334,13 +787,199 @@ int sm_ep_del_event(struct sock_manager* sm, struct sock_session* ss, unsigned i
 }
 
 
+/*
+	cross-thread mailbox
+*/
+
+static void s_mailbox_push(sock_manager_t* sm, sock_command_t* cmd) {
+	__atomic_store_n(&cmd->next, 0, __ATOMIC_RELAXED);
+	sock_command_t* prev = __atomic_exchange_n(&sm->mailbox_head, cmd, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, cmd, __ATOMIC_RELEASE);
+}
+
+/**
+*	s_mailbox_pop - Only called by the loop thread
+*	return a command, or 0 if empty (or a producer is between its two steps)
+*/
+static sock_command_t* s_mailbox_pop(sock_manager_t* sm) {
+	sock_command_t* tail = sm->mailbox_tail;
+	sock_command_t* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	if (tail == &sm->mailbox_stub) {
+		if (next == 0)
+			return 0;
+		sm->mailbox_tail = tail = next;
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	}
+
+	if (next) {
+		sm->mailbox_tail = next;
+		return tail;
+	}
+
+	if (tail != __atomic_load_n(&sm->mailbox_head, __ATOMIC_ACQUIRE))
+		return 0;
+
+	s_mailbox_push(sm, &sm->mailbox_stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		sm->mailbox_tail = next;
+		return tail;
+	}
+	return 0;
+}
+
+static int s_mailbox_post(sock_manager_t* sm, sock_command_t* cmd) {
+	s_mailbox_push(sm, cmd);
+
+	//only the first producer after a drain pays the write syscall
+	if (__atomic_exchange_n(&sm->mailbox_signaled, 1, __ATOMIC_ACQ_REL) == 0) {
+		uint64_t one = 1;
+		if (write(sm->mailbox_ss->fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+			//the command stays queued, let the next post try the wakeup again
+			__atomic_store_n(&sm->mailbox_signaled, 0, __ATOMIC_SEQ_CST);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static sock_command_t* s_mailbox_command(sock_command_type_t type, sock_session_t* ss, const char* data, uint32_t data_len) {
+	sock_command_t* cmd = (sock_command_t*)malloc(sizeof(sock_command_t) + data_len);
+	if (cmd == 0)
+		return 0;
+
+	memset(cmd, 0, sizeof(sock_command_t));
+	cmd->type = type;
+	if (ss)
+		cmd->handle = ss->handle;
+	if (data_len) {
+		memcpy(cmd->data, data, data_len);
+		cmd->data_len = data_len;
+	}
+	return cmd;
+}
+
+static void s_mailbox_exec(sock_manager_t* sm, sock_command_t* cmd) {
+	sock_session_t* ss = sm_session_from_handle(sm, cmd->handle);
+
+	switch (cmd->type) {
+	case SOCK_CMD_SEND:
+		if (ss && ss->flag.bit_closed == 0 && ss->ops->on_protocol_send_cb)
+			ss->ops->on_protocol_send_cb(ss, cmd->data, cmd->data_len);
+		break;
+	case SOCK_CMD_CLOSE:
+		if (ss && ss->flag.bit_closed == 0)
+			sm_del_session(ss, cmd->delay_destruction);
+		break;
+	case SOCK_CMD_BROADCAST:
+		sm_broadcast_online(sm, cmd->data, cmd->data_len);
+		break;
+	case SOCK_CMD_CLOSURE:
+		cmd->closure(sm, cmd->user_data);
+		break;
+	}
+}
+
+//eventfd readable
+static void mailbox_cb(sock_session_t* ss) {
+	sock_manager_t* sm = ss->manager_ptr;
+	uint64_t count;
+
+	//reset the eventfd first, a producer that pushes after this point signals again
+	read(ss->fd, &count, sizeof(count));
+	__atomic_store_n(&sm->mailbox_signaled, 0, __ATOMIC_SEQ_CST);
+
+	int batch = 0;
+	sock_command_t* cmd;
+	while (batch < MAX_MAILBOX_BATCH && (cmd = s_mailbox_pop(sm))) {
+		s_mailbox_exec(sm, cmd);
+		free(cmd);
+		++batch;
+	}
+
+	//leave the rest to the pending list so that one busy producer can not starve the sockets
+	if (batch == MAX_MAILBOX_BATCH) {
+		if (list_empty(&ss->elem_pending_recv) != 0)
+			list_add_tail(&ss->elem_pending_recv, &sm->list_pending_recv);
+	}
+	else if (list_empty(&ss->elem_pending_recv) == 0) {
+		list_del_init(&ss->elem_pending_recv);
+	}
+}
+
+static int s_mailbox_init(sock_manager_t* sm) {
+	sm->mailbox_head = sm->mailbox_tail = &sm->mailbox_stub;
+
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	sm->mailbox_ss = s_cache_session(sm, 0, 0, 0, 0);
+	if (sm->mailbox_ss == 0) {
+		close(fd);
+		return -1;
+	}
+
+	sm->mailbox_ss->fd = fd;
+	sm->mailbox_ss->manager_ptr = sm;
+	sm->mailbox_ss->on_recv_cb = mailbox_cb;
+	if (sm_ep_add_event(sm, sm->mailbox_ss, EPOLLIN)) {
+		s_free_session(sm, sm->mailbox_ss);
+		sm->mailbox_ss = 0;
+		close(fd);
+		return -1;
+	}
+	return 0;
+}
+
+static void s_mailbox_destroy(sock_manager_t* sm) {
+	if (sm->mailbox_ss == 0)
+		return;
+
+	//commands still in the queue are dropped
+	sock_command_t* cmd;
+	while ((cmd = s_mailbox_pop(sm))) {
+		free(cmd);
+	}
+
+	close(sm->mailbox_ss->fd);
+	s_free_session(sm, sm->mailbox_ss);
+	sm->mailbox_ss = 0;
+}
+
+
 /*
 	callback function
 */
 
+/**
+*	s_accept_session - Create the client session of an accepted fileno
+*	@ss: listener session
+*/
+static void s_accept_session(sock_session_t* ss, int c_fd, struct sockaddr_in* c_sin) {
+	sock_session_t* c_ss;
+	const char* ip = inet_ntoa(c_sin->sin_addr);
+	unsigned short port = ntohs(c_sin->sin_port);
+
+	int et = 1;
+	int add_online = 1;
+
+	//ret = sm_add_client_session(ss->manager_ptr, c_fd, ip, port,ss->flag.bit_proto_commu, et, add_online,MIN_RECV_BUFFER_LENGTH,MAX_RECV_BUFFER_LENGTH,MIN_SEND_BUFFER_LENGTH,MAX_SEND_BUFFER_LENGTH, cb_recv, cb_ping, ss->on_complate_pkg_cb, cb_send, ss->on_disconn_event_cb, ss->user_data);
+	//the listener holds the callbacks of its clients, a routed one until the handshake only
+	c_ss = s_add_client_session(ss->manager_ptr, c_fd, ip, port, ss->flag.bit_proto_commu, et, add_online, ss->i_buf.recv_buf_length, ss->i_buf.recv_buf_max, ss->o_buf.send_buf_length, ss->o_buf.send_buf_max,
+		ss->web_router ? ss->web_router->pending_ops : ss->ops, ss, ss->user_data);
+	if (!c_ss) {
+		close(c_fd);
+		printf("[%s] [%s:%d] [%s] function return failed. errmsg: [ %s ], ip: [%s], port: [%d]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, strerror(errno), ip, port);
+	}
+	else {
+		printf("[%s] [%s:%d] [%s] accept success. ip: [%s], port: [%d]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ip, port);
+	}
+}
+
 static void accept_cb(sock_session_t* ss) {
 	do {
-		int ret;
 		struct sockaddr_in c_sin;
 		socklen_t s_len = sizeof(c_sin);
 		memset(&c_sin, 0, sizeof(c_sin));
@@ -361,47 +1000,7 @@ static void accept_cb(sock_session_t* ss) {
 
 		//tools_set_nonblocking(c_fd);
 
-		void* cb_recv = 0, * cb_send = 0, * cb_ping = 0;
-
-		switch (ss->flag.bit_proto_commu) {
-		case PROTO_COMMU_TCP_BINARY:
-			cb_recv = tcp_binary_protocol_recv;
-			cb_send = tcp_binary_protocol_send;
-			cb_ping = tcp_binary_protocol_ping;
-			break;
-		case PROTO_COMMU_TCP_JSON:
-			cb_recv = tcp_json_protocol_recv;
-			cb_send = tcp_json_protocol_send;
-			cb_ping = tcp_json_protocol_ping;
-			break;
-		case PROTO_COMMU_WEBSOCKET_BINARY:
-		case PROTO_COMMU_WEBSOCKET_JSON:
-			cb_recv = web_protocol_recv;
-			cb_send = web_protocol_send;
-			cb_ping = web_protocol_ping;
-			break;
-		case PROTO_COMMU_DIY:
-			cb_recv = ss->on_protocol_recv_cb;
-			cb_send = ss->on_protocol_send_cb;
-			cb_ping = ss->on_protocol_ping_cb;
-			break;
-		}
-
-		const char* ip = inet_ntoa(c_sin.sin_addr);
-		unsigned short port = ntohs(c_sin.sin_port);
-
-		int et = 1;
-		int add_online = 1;
-
-		//ret = sm_add_client_session(ss->manager_ptr, c_fd, ip, port,ss->flag.bit_proto_commu, et, add_online,MIN_RECV_BUFFER_LENGTH,MAX_RECV_BUFFER_LENGTH,MIN_SEND_BUFFER_LENGTH,MAX_SEND_BUFFER_LENGTH, cb_recv, cb_ping, ss->on_complate_pkg_cb, cb_send, ss->on_disconn_event_cb, ss->user_data);
-		ret = sm_add_client_session(ss->manager_ptr, c_fd, ip, port, ss->flag.bit_proto_commu, et, add_online, ss->i_buf.recv_buf_length, ss->i_buf.recv_buf_max, ss->o_buf.send_buf_length, ss->o_buf.send_buf_max, cb_recv, cb_ping, ss->on_complate_pkg_cb, cb_send, ss->on_create_event_cb, ss->on_disconn_event_cb, ss->user_data);
-		if (!ret) {
-			close(c_fd);
-			printf("[%s] [%s:%d] [%s] function return failed. errmsg: [ %s ], ip: [%s], port: [%d]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, strerror(errno), ip, port);
-		}
-		else {
-			printf("[%s] [%s:%d] [%s] accept success. ip: [%s], port: [%d]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ip, port);
-		}
+		s_accept_session(ss, c_fd, &c_sin);
 	} while (ss->flag.bit_etmod);
 
 
@@ -411,50 +1010,420 @@ static void accept_cb(sock_session_t* ss) {
 
 
 /*
-	API
+	io_uring backend
+	One io_uring_enter per loop iteration: it submits the queued requests and waits the completions.
+	Listeners use multishot accept, client sessions multishot recv with a provided buffer ring,
+	other fds (mailbox eventfd) multishot poll. The output buffer of a session is sent with one
+	send request, the session callbacks and the protocol functions are the same as with epoll.
 */
 
-sock_manager_t* sm_init_manager() {
-	sock_manager_t* sm = (sock_manager_t*)malloc(sizeof(sock_manager_t));
-	if (!sm)return 0;
-
-	memset(sm, 0, sizeof(sock_manager_t));
-	sm_set_running(sm, 1);
+#ifdef SM_ENABLE_IO_URING
 
-	//Init all list
-	INIT_LIST_HEAD(&(sm->list_online));
-	INIT_LIST_HEAD(&(sm->list_offline));
-	INIT_LIST_HEAD(&(sm->list_servers));
-	INIT_LIST_HEAD(&(sm->list_listens));
-	INIT_LIST_HEAD(&(sm->list_pending_recv));
-	INIT_LIST_HEAD(&(sm->list_pending_send));
+#define URING_BUF_GROUP (0)
 
-	//inti timer manager
-	sm->ht_timer = ht_create_heap_timer();
-	if (sm->ht_timer == 0)
-		goto sm_init_manager_failed;
+//user_data of a request: session pointer | op
+#define URING_OP_MASK (7)
+#define URING_OP_ACCEPT (1)
+#define URING_OP_RECV (2)
+#define URING_OP_POLL (3)
+#define URING_OP_SEND (4)
 
-	//init epoll, try twice
-	sm->ep_fd = epoll_create(EPOLL_CLOEXEC);
-	if (sm->ep_fd == -1) {
-		sm->ep_fd = epoll_create(1 << 15);	//32768
-		if (sm->ep_fd == -1) {
-			goto sm_init_manager_failed;
-		}
+static struct io_uring_sqe* s_uring_get_sqe(sock_manager_t* sm) {
+	struct io_uring_sqe* sqe = io_uring_get_sqe(sm->uring);
+	//submission queue full, flush it without waiting
+	if (sqe == 0) {
+		io_uring_submit(sm->uring);
+		sqe = io_uring_get_sqe(sm->uring);
 	}
+	return sqe;
+}
 
-	//add default timer
-	//heart cb
-	ht_add_timer(sm->ht_timer, MAX_HEART_TIMEOUT * 1000, 0, -1, cb_on_heart_timeout, sm);
-	//server reconnect cb
-	ht_add_timer(sm->ht_timer, MAX_RECONN_SERVER_TIMEOUT * 1000, 0, -1, cb_on_reconnection_timeout, sm);
-
-	return sm;
+static int s_uring_prep(sock_manager_t* sm, sock_session_t* ss, int op) {
+	struct io_uring_sqe* sqe = s_uring_get_sqe(sm);
+	if (sqe == 0)
+		return -1;
 
-sm_init_manager_failed:
-	if (sm->ht_timer) {
-		ht_destroy_heap_timer(sm->ht_timer);
+	switch (op) {
+	case URING_OP_ACCEPT:
+		io_uring_prep_multishot_accept(sqe, ss->fd, 0, 0, SOCK_CLOEXEC);
+		break;
+	case URING_OP_RECV:
+		io_uring_prep_recv_multishot(sqe, ss->fd, 0, 0, 0);
+		sqe->flags |= IOSQE_BUFFER_SELECT;
+		sqe->buf_group = URING_BUF_GROUP;
+		break;
+	case URING_OP_POLL:
+		io_uring_prep_poll_multishot(sqe, ss->fd, POLLIN);
+		break;
+	case URING_OP_SEND:
+		io_uring_prep_sendmsg(sqe, ss->fd, &ss->uring_msg, MSG_NOSIGNAL);
+		break;
 	}
+
+	io_uring_sqe_set_data64(sqe, (uint64_t)(uintptr_t)ss | op);
+	++ss->uring_inflight;
+	return 0;
+}
+
+static int s_uring_add_event(sock_manager_t* sm, sock_session_t* ss, unsigned int epoll_event) {
+	if ((epoll_event & EPOLLIN) && !(ss->epoll_state & EPOLLIN)) {
+		int op = URING_OP_POLL;
+		if (ss->on_recv_cb == accept_cb)
+			op = URING_OP_ACCEPT;
+		else if (ss->on_recv_cb == sm_recv)
+			op = URING_OP_RECV;
+
+		if (s_uring_prep(sm, ss, op))
+			return -1;
+		ss->epoll_state |= EPOLLIN;
+	}
+
+	//the send request is prepared by sm_pending_send at the end of the iteration
+	if (epoll_event & EPOLLOUT) {
+		ss->epoll_state |= EPOLLOUT;
+		if (list_empty(&ss->elem_pending_send) != 0)
+			list_add_tail(&ss->elem_pending_send, &sm->list_pending_send);
+	}
+	return 0;
+}
+
+static int s_uring_del_event(sock_manager_t* sm, sock_session_t* ss, unsigned int epoll_event) {
+	ss->epoll_state &= (~epoll_event);
+
+	/*
+		stop receiving, the cancelled requests still complete before the session can be released.
+		Submit at once, the fd may be closed and its number reused before the next iteration
+	*/
+	if (epoll_event & EPOLLIN) {
+		struct io_uring_sqe* sqe = s_uring_get_sqe(sm);
+		if (sqe == 0)
+			return -1;
+		io_uring_prep_cancel_fd(sqe, ss->fd, IORING_ASYNC_CANCEL_ALL);
+		io_uring_sqe_set_data64(sqe, 0);
+		io_uring_submit(sm->uring);
+	}
+	return 0;
+}
+
+/**
+*	s_uring_send - Hand the head segments of the output buffer to the ring, called by sm_send
+*/
+static void s_uring_send(sock_session_t* ss) {
+	sock_manager_t* sm = ss->manager_ptr;
+
+	if (list_empty(&ss->elem_pending_send) == 0)
+		list_del_init(&ss->elem_pending_send);
+
+	//one send in flight, the completion sends the rest
+	if (ss->uring_send_len || ss->o_buf.send_len == 0)
+		return;
+
+	memset(&ss->uring_msg, 0, sizeof(ss->uring_msg));
+	ss->uring_msg.msg_iov = ss->uring_iov;
+	ss->uring_msg.msg_iovlen = netio_obuf_iov(&ss->o_buf, ss->uring_iov, MAX_URING_SEND_IOV, &ss->uring_send_len);
+
+	if (s_uring_prep(sm, ss, URING_OP_SEND)) {
+		ss->uring_send_len = 0;
+		printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, "io_uring submission queue full");
+		sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
+	}
+}
+
+static void s_uring_on_send(sock_manager_t* sm, sock_session_t* ss, int res) {
+	if (ss->flag.bit_closed == 0) {
+		if (res == -EAGAIN || res == -EINTR) {
+			res = 0;
+		}
+		else if (res < 0) {
+			printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, strerror(-res));
+			sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
+		}
+	}
+
+	ss->uring_send_len = 0;
+	//s_del_session left the segments to the completion
+	if (ss->flag.bit_closed) {
+		netio_obuf_destroy(&ss->o_buf);
+		return;
+	}
+
+	//release the sent segments, the rest of a short send and the data appended meanwhile go with the next request
+	netio_obuf_drain(&ss->o_buf, res);
+
+	if (ss->o_buf.send_len) {
+		if (list_empty(&ss->elem_pending_send) != 0)
+			list_add_tail(&ss->elem_pending_send, &sm->list_pending_send);
+	}
+	else {
+		ss->epoll_state &= (~EPOLLOUT);
+	}
+}
+
+static void s_uring_on_recv(sock_manager_t* sm, sock_session_t* ss, struct io_uring_cqe* cqe) {
+	const char* errmsg = 0;
+	int res = cqe->res;
+
+	if (res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+		uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		const char* data = sm->uring_bufs + (size_t)bid * MAX_URING_BUF_SIZE;
+		uint32_t copied = 0;
+
+		if (netio_ibuf_acquire(&ss->i_buf))
+			errmsg = "Alloc input buffer failed";
+
+		//the provided buffer goes back to the ring once copied into i_buf
+		while (errmsg == 0 && ss->flag.bit_closed == 0 && copied < res) {
+			if (netio_ibuf_check_full(&ss->i_buf)) {
+				errmsg = "User mode buffer full";
+				break;
+			}
+			uint32_t unused_len = netio_ibuf_unused_length(&ss->i_buf);
+			if (unused_len > res - copied)
+				unused_len = res - copied;
+
+			memcpy(netio_ibuf_breakpoint(&ss->i_buf), data + copied, unused_len);
+			ss->i_buf.recv_len += unused_len;
+			copied += unused_len;
+
+			if (ss->ops->on_protocol_recv_cb)
+				ss->ops->on_protocol_recv_cb(ss);
+		}
+
+		io_uring_buf_ring_add(sm->uring_br, (void*)data, MAX_URING_BUF_SIZE, bid, io_uring_buf_ring_mask(MAX_URING_BUF_COUNT), 0);
+		io_uring_buf_ring_advance(sm->uring_br, 1);
+		netio_ibuf_release(&ss->i_buf);
+	}
+	else if (res == 0) {
+		errmsg = "client disconnect";
+	}
+	//out of provided buffers or cancelled, not an error of the session
+	else if (res != -ENOBUFS && res != -ECANCELED) {
+		errmsg = strerror(-res);
+	}
+
+	if (errmsg && ss->flag.bit_closed == 0) {
+		printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, errmsg);
+		sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
+	}
+}
+
+static void s_uring_dispatch(sock_manager_t* sm, struct io_uring_cqe* cqe) {
+	uint64_t ud = io_uring_cqe_get_data64(cqe);
+	//cancel requests
+	if (ud == 0)
+		return;
+
+	sock_session_t* ss = (sock_session_t*)(uintptr_t)(ud & ~(uint64_t)URING_OP_MASK);
+	int op = ud & URING_OP_MASK;
+	int more = cqe->flags & IORING_CQE_F_MORE;
+
+	if (more == 0)
+		--ss->uring_inflight;
+
+	switch (op) {
+	case URING_OP_ACCEPT:
+		if (cqe->res >= 0) {
+			struct sockaddr_in c_sin;
+			socklen_t s_len = sizeof(c_sin);
+			memset(&c_sin, 0, sizeof(c_sin));
+			getpeername(cqe->res, (struct sockaddr*)&c_sin, &s_len);
+			s_accept_session(ss, cqe->res, &c_sin);
+		}
+		else if (cqe->res != -ECANCELED) {
+			printf("[%s] [%s:%d] [%s] Accept function failed. errmsg: [ %s ]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, strerror(-cqe->res));
+			//same as s_try_accept, raise the fileno limit before the accept is armed again
+			if (cqe->res == -EMFILE) {
+				errno = EMFILE;
+				tools_nofile_ckup();
+			}
+		}
+		break;
+	case URING_OP_RECV:
+		s_uring_on_recv(sm, ss, cqe);
+		break;
+	case URING_OP_POLL:
+		if (cqe->res > 0 && ss->flag.bit_closed == 0)
+			ss->on_recv_cb(ss);
+		break;
+	case URING_OP_SEND:
+		s_uring_on_send(sm, ss, cqe->res);
+		return;
+	}
+
+	//multishot request finished, arm it again
+	if (more == 0 && cqe->res != -ECANCELED && ss->flag.bit_closed == 0 && (ss->epoll_state & EPOLLIN)) {
+		if (s_uring_prep(sm, ss, op)) {
+			printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, "io_uring submission queue full");
+			sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
+		}
+	}
+}
+
+static int s_uring_run(sock_manager_t* sm, uint64_t us) {
+	struct io_uring_cqe* cqe;
+	struct __kernel_timespec ts;
+	struct __kernel_timespec* pts = 0;
+	unsigned head, count = 0;
+
+	//same unit as the epoll_wait timeout, -1 waits forever
+	if ((int)us >= 0) {
+		ts.tv_sec = (int)us / 1000;
+		ts.tv_nsec = ((int)us % 1000) * 1000000;
+		pts = &ts;
+	}
+
+	int ret = io_uring_submit_and_wait_timeout(sm->uring, &cqe, 1, pts, 0);
+	if (ret < 0 && ret != -ETIME && ret != -EINTR) {
+		errno = -ret;
+		return -1;
+	}
+
+	io_uring_for_each_cqe(sm->uring, head, cqe) {
+		s_uring_dispatch(sm, cqe);
+		++count;
+	}
+	io_uring_cq_advance(sm->uring, count);
+
+	sm_pending_send(sm);
+	sm_pending_recv(sm);
+	sm_clear_offline(sm);
+	return 0;
+}
+
+static int s_uring_init(sock_manager_t* sm) {
+	int ret;
+
+	sm->uring = (struct io_uring*)malloc(sizeof(struct io_uring));
+	sm->uring_bufs = (char*)malloc((size_t)MAX_URING_BUF_COUNT * MAX_URING_BUF_SIZE);
+	if (sm->uring == 0 || sm->uring_bufs == 0)
+		goto s_uring_init_failed;
+
+	ret = io_uring_queue_init(MAX_URING_ENTRIES, sm->uring, 0);
+	if (ret < 0) {
+		free(sm->uring);
+		sm->uring = 0;
+		errno = -ret;
+		goto s_uring_init_failed;
+	}
+
+	sm->uring_br = io_uring_setup_buf_ring(sm->uring, MAX_URING_BUF_COUNT, URING_BUF_GROUP, 0, &ret);
+	if (sm->uring_br == 0) {
+		errno = -ret;
+		goto s_uring_init_failed;
+	}
+
+	for (int i = 0; i < MAX_URING_BUF_COUNT; ++i) {
+		io_uring_buf_ring_add(sm->uring_br, sm->uring_bufs + (size_t)i * MAX_URING_BUF_SIZE, MAX_URING_BUF_SIZE, i, io_uring_buf_ring_mask(MAX_URING_BUF_COUNT), i);
+	}
+	io_uring_buf_ring_advance(sm->uring_br, MAX_URING_BUF_COUNT);
+	return 0;
+
+s_uring_init_failed:
+	if (sm->uring) {
+		io_uring_queue_exit(sm->uring);
+		free(sm->uring);
+		sm->uring = 0;
+	}
+	if (sm->uring_bufs) {
+		free(sm->uring_bufs);
+		sm->uring_bufs = 0;
+	}
+	return -1;
+}
+
+/**
+*	s_uring_exit - Release the ring, the requests still in flight are dropped with it
+*/
+static void s_uring_exit(sock_manager_t* sm) {
+	if (sm->uring == 0)
+		return;
+
+	if (sm->uring_br)
+		io_uring_free_buf_ring(sm->uring, sm->uring_br, MAX_URING_BUF_COUNT, URING_BUF_GROUP);
+	io_uring_queue_exit(sm->uring);
+	free(sm->uring);
+	free(sm->uring_bufs);
+	sm->uring = 0;
+	sm->uring_br = 0;
+	sm->uring_bufs = 0;
+
+	//no completion will arrive anymore
+	sock_session_t* pos;
+	list_for_each_entry(pos, &sm->list_offline, elem_offline) {
+		pos->uring_inflight = 0;
+	}
+	list_for_each_entry(pos, &sm->list_servers, elem_servers) {
+		pos->uring_inflight = 0;
+	}
+	if (sm->mailbox_ss)
+		sm->mailbox_ss->uring_inflight = 0;
+	sm->mng_flag.bit_closed = ~0;
+}
+
+#endif//SM_ENABLE_IO_URING
+
+
+/*
+	API
+*/
+
+sock_manager_t* sm_init_manager() {
+	sock_manager_t* sm = (sock_manager_t*)malloc(sizeof(sock_manager_t));
+	if (!sm)return 0;
+
+	memset(sm, 0, sizeof(sock_manager_t));
+	sm_set_running(sm, 1);
+
+	//Init all list
+	INIT_LIST_HEAD(&(sm->list_online));
+	INIT_LIST_HEAD(&(sm->list_offline));
+	INIT_LIST_HEAD(&(sm->list_servers));
+	INIT_LIST_HEAD(&(sm->list_listens));
+	INIT_LIST_HEAD(&(sm->list_pending_recv));
+	INIT_LIST_HEAD(&(sm->list_pending_send));
+	INIT_LIST_HEAD(&(sm->list_dirty));
+	for (int i = 0; i < MAX_IDLE_WHEEL_SIZE; ++i)
+		INIT_LIST_HEAD(&(sm->idle_wheel[i]));
+	sm->idle_time = time(0);
+	INIT_LIST_HEAD(&(sm->list_free_sessions));
+	sm->handle_free = MAX_HANDLE_NIL;
+	netio_pool_init(&sm->buf_pool);
+
+	//inti timer manager
+	sm->tw_timer = tw_create_timer_wheel();
+	if (sm->tw_timer == 0)
+		goto sm_init_manager_failed;
+
+	//init epoll, try twice
+	sm->ep_fd = epoll_create(EPOLL_CLOEXEC);
+	if (sm->ep_fd == -1) {
+		sm->ep_fd = epoll_create(1 << 15);	//32768
+		if (sm->ep_fd == -1) {
+			goto sm_init_manager_failed;
+		}
+	}
+
+	//init cross-thread mailbox
+	if (s_mailbox_init(sm))
+		goto sm_init_manager_failed;
+
+	//add default timer
+	//heart cb
+	tw_add_timer(sm->tw_timer, 1000, 0, -1, cb_on_heart_timeout, sm);
+	//server reconnect cb
+	tw_add_timer(sm->tw_timer, MAX_RECONN_SERVER_TIMEOUT * 1000, 0, -1, cb_on_reconnection_timeout, sm);
+
+	return sm;
+
+sm_init_manager_failed:
+	if (sm->ep_fd > 0) {
+		close(sm->ep_fd);
+	}
+	if (sm->tw_timer) {
+		tw_destroy_timer_wheel(sm->tw_timer);
+	}
+	s_destroy_sessions(sm);
+	netio_pool_destroy(&sm->buf_pool);
 	if (sm) {
 		free(sm);
 	}
@@ -468,17 +1437,17 @@ void sm_exit_manager(sock_manager_t* sm) {
 	//clean resources and all session
 	sock_session_t* pos, *n;
 	list_for_each_entry_safe(pos, n, &sm->list_online, elem_online) {
-		printf("[%s] [%s:%d] [%s] Clean Online session, ip: [%s], port: [%d] errmsg: [Active cleaning]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, pos->ip, pos->port);
+		printf("[%s] [%s:%d] [%s] Clean Online session, ip: [%s], port: [%d] errmsg: [Active cleaning]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, pos->info.ip, pos->info.port);
 		sm_del_session(pos, 0);
 	}
 
 	list_for_each_entry_safe(pos, n, &sm->list_servers, elem_servers) {
-		printf("[%s] [%s:%d] [%s] Clean server session, ip: [%s], port: [%d] errmsg: [Active cleaning]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, pos->ip, pos->port);
+		printf("[%s] [%s:%d] [%s] Clean server session, ip: [%s], port: [%d] errmsg: [Active cleaning]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, pos->info.ip, pos->info.port);
 		sm_del_session(pos, 0);
 	}
 
 	list_for_each_entry_safe(pos, n, &sm->list_listens, elem_listens) {
-		printf("[%s] [%s:%d] [%s] Clean listener session, ip: [%s], port: [%d] errmsg: [Active cleaning]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, pos->ip, pos->port);
+		printf("[%s] [%s:%d] [%s] Clean listener session, ip: [%s], port: [%d] errmsg: [Active cleaning]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, pos->info.ip, pos->info.port);
 		close(pos->fd);
 		list_del_init(&pos->elem_listens);
 		s_free_session(sm, pos);
@@ -486,9 +1455,19 @@ void sm_exit_manager(sock_manager_t* sm) {
 
 	sm_clear_offline(sm);
 
-	if (sm->ht_timer) {
-		ht_destroy_heap_timer(sm->ht_timer);
+#ifdef SM_ENABLE_IO_URING
+	s_uring_exit(sm);
+	sm_clear_offline(sm);
+#endif//SM_ENABLE_IO_URING
+
+	s_mailbox_destroy(sm);
+	close(sm->ep_fd);
+
+	if (sm->tw_timer) {
+		tw_destroy_timer_wheel(sm->tw_timer);
 	}
+	s_destroy_sessions(sm);
+	netio_pool_destroy(&sm->buf_pool);
 	if (sm) {
 		free(sm);
 	}
@@ -505,6 +1484,116 @@ void sm_set_running(sock_manager_t* sm, uint8_t running) {
 	}
 }
 
+void sm_set_write_first(sock_manager_t* sm, uint8_t enable) {
+	if (sm) {
+		if (enable) {
+			sm->mng_flag.bit_write_first = ~0;
+		}
+		else {
+			sm->mng_flag.bit_write_first = 0;
+		}
+	}
+}
+
+void sm_set_write_coalesce(sock_manager_t* sm, uint8_t enable) {
+	if (sm) {
+		if (enable) {
+			sm->mng_flag.bit_coalesce = ~0;
+		}
+		else {
+			sm->mng_flag.bit_coalesce = 0;
+			//nothing may stay behind in the dirty list
+			sm_flush_dirty(sm);
+		}
+	}
+}
+
+int sm_reserve_sessions(sock_manager_t* sm, uint32_t session_count, uint32_t recv_len, uint32_t send_len) {
+	if (sm == 0)
+		return -1;
+
+	while (sm->session_free < session_count) {
+		if (s_grow_sessions(sm))
+			return -1;
+	}
+
+	if (recv_len && netio_pool_reserve(&sm->buf_pool, recv_len, session_count))
+		return -1;
+	if (send_len && netio_pool_reserve(&sm->buf_pool, send_len, session_count))
+		return -1;
+	return 0;
+}
+
+void sm_set_buffer_cache(sock_manager_t* sm, uint64_t cache_limit) {
+	if (sm)
+		sm->buf_pool.cache_limit = cache_limit;
+}
+
+void sm_get_pool_stats(sock_manager_t* sm, sm_pool_stats_t* stats) {
+	if (sm == 0 || stats == 0)
+		return;
+
+	stats->session_total = sm->session_total;
+	stats->session_free = sm->session_free;
+	stats->session_slabs = sm->session_slabs;
+	stats->buffer_alloc = sm->buf_pool.alloc_count;
+	stats->buffer_hit = sm->buf_pool.hit_count;
+	stats->buffer_cached = sm->buf_pool.cached_bytes;
+}
+
+int sm_set_backend(sock_manager_t* sm, sock_backend_t backend) {
+	if (sm == 0)
+		return -1;
+
+#ifdef SM_ENABLE_IO_URING
+	if ((backend == SOCK_BACKEND_IO_URING) == (sm->uring != 0))
+		return 0;
+
+	//only the mailbox may be registered yet
+	if (list_empty(&sm->list_online) == 0 || list_empty(&sm->list_servers) == 0 || list_empty(&sm->list_listens) == 0 || list_empty(&sm->list_offline) == 0)
+		return -1;
+
+	sm_ep_del_event(sm, sm->mailbox_ss, EPOLLIN);
+	if (backend == SOCK_BACKEND_IO_URING) {
+		if (s_uring_init(sm)) {
+			printf("[%s] [%s:%d] [%s] Init io_uring errmsg: [%s]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, strerror(errno));
+			sm_ep_add_event(sm, sm->mailbox_ss, EPOLLIN);
+			return -1;
+		}
+	}
+	else {
+		s_uring_exit(sm);
+	}
+	return sm_ep_add_event(sm, sm->mailbox_ss, EPOLLIN);
+#else
+	return backend == SOCK_BACKEND_EPOLL ? 0 : -1;
+#endif//SM_ENABLE_IO_URING
+}
+
+void sm_set_reuseport(sock_manager_t* sm, uint8_t enable) {
+	if (sm) {
+		if (enable) {
+			sm->mng_flag.bit_reuseport = ~0;
+		}
+		else {
+			sm->mng_flag.bit_reuseport = 0;
+		}
+	}
+}
+
+void sm_set_id_strategy(sock_manager_t* sm, sock_id_strategy_t strategy) {
+	if (sm)
+		sm->id_strategy = strategy;
+}
+
+const char* sm_session_uuid(sock_session_t* ss) {
+	if (ss == 0)
+		return 0;
+	if (ss->info.uuid[0] == 0)
+		tools_format_id_r(ss->info.id, ss->info.uuid);
+	return ss->info.uuid;
+}
+
 int sm_add_defult_listen(sock_manager_t* sm, uint16_t listen_port, uint32_t max_listen, session_proto_commu_t proto_commu, uint8_t enable_et,
 	uint32_t client_min_recv_len, uint32_t client_max_recv_len, uint32_t client_min_send_len, uint32_t client_max_send_len,
 	void (*client_on_complate_pkg_cb)(sock_session_t*, char*, uint32_t),
@@ -546,6 +1635,13 @@ int sm_add_defult_listen(sock_manager_t* sm, uint16_t listen_port, uint32_t max_
 	//address reuse
 	ret = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
 
+	//port reuse, each manager of a reactor group owns one listener on the same port
+	if (sm->mng_flag.bit_reuseport) {
+		ret = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
+		if (ret == -1)
+			goto sm_add_defult_listen_failed;
+	}
+
 	ret = bind(fd, (const struct sockaddr*) & sin, sizeof(sin));
 	if (ret == -1) 
 		goto sm_add_defult_listen_failed;
@@ -571,9 +1667,14 @@ int sm_add_defult_listen(sock_manager_t* sm, uint16_t listen_port, uint32_t max_
 	ss->flag.bit_proto_commu = proto_commu;
 	
 	ss->on_recv_cb = accept_cb;
-	ss->on_complate_pkg_cb = client_on_complate_pkg_cb;
-	ss->on_disconn_event_cb = client_on_disconn_event_cb;
-	ss->on_create_event_cb = client_on_create_event_cb;
+	sock_session_ops_t ops = { 0 };
+	s_protocol_ops(proto_commu, &ops);
+	ops.on_complate_pkg_cb = client_on_complate_pkg_cb;
+	ops.on_create_event_cb = client_on_create_event_cb;
+	ops.on_disconn_event_cb = client_on_disconn_event_cb;
+	ss->ops = s_session_ops(sm, &ops);
+	if (ss->ops == 0)
+		goto sm_add_defult_listen_failed;
 
 	//add to listener list
 	list_add_tail(&(ss->elem_listens), &(sm->list_listens));
@@ -588,7 +1689,7 @@ int sm_add_defult_listen(sock_manager_t* sm, uint16_t listen_port, uint32_t max_
 
 sm_add_defult_listen_failed:
 	if (ss) {
-		free(ss);
+		s_free_session(sm, ss);
 	}
 	if (fd != -1) {
 		close(fd);
@@ -642,6 +1743,13 @@ int sm_add_diy_listen(sock_manager_t* sm, uint16_t listen_port, uint32_t max_lis
 	//address reuse
 	ret = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
 
+	//port reuse, each manager of a reactor group owns one listener on the same port
+	if (sm->mng_flag.bit_reuseport) {
+		ret = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
+		if (ret == -1)
+			goto sm_add_diy_listen_failed;
+	}
+
 	ret = bind(fd, (const struct sockaddr*) & sin, sizeof(sin));
 	if (ret == -1)
 		goto sm_add_diy_listen_failed;
@@ -663,12 +1771,17 @@ int sm_add_diy_listen(sock_manager_t* sm, uint16_t listen_port, uint32_t max_lis
 	ss->flag.bit_proto_commu = PROTO_COMMU_DIY;
 
 	ss->on_recv_cb = accept_cb;
-	ss->on_protocol_recv_cb = client_on_protocol_recv_cb;
-	ss->on_protocol_send_cb = client_on_protocol_send_cb;
-	ss->on_protocol_ping_cb = client_on_protocol_ping_cb;
-	ss->on_complate_pkg_cb = client_on_complate_pkg_cb;
-	ss->on_disconn_event_cb = client_on_disconn_event_cb;
-	ss->on_create_event_cb = client_on_create_event_cb;
+	sock_session_ops_t ops = {
+		client_on_protocol_recv_cb,
+		client_on_protocol_send_cb,
+		client_on_protocol_ping_cb,
+		client_on_complate_pkg_cb,
+		client_on_create_event_cb,
+		client_on_disconn_event_cb,
+	};
+	ss->ops = s_session_ops(sm, &ops);
+	if (ss->ops == 0)
+		goto sm_add_diy_listen_failed;
 
 	list_add_tail(&(ss->elem_listens), &(sm->list_listens));
 
@@ -681,7 +1794,7 @@ int sm_add_diy_listen(sock_manager_t* sm, uint16_t listen_port, uint32_t max_lis
 
 sm_add_diy_listen_failed:
 	if (ss) {
-		free(ss);
+		s_free_session(sm, ss);
 	}
 	if (fd != -1) {
 		close(fd);
@@ -690,18 +1803,41 @@ sm_add_diy_listen_failed:
 	return -1;
 }
 
-sock_session_t* sm_add_client_session(sock_manager_t* sm, int fd, const char* ip, uint16_t port, session_proto_commu_t proto_commu ,uint8_t enable_et, uint8_t add_online,
-	uint32_t min_recv_len, uint32_t max_recv_len, uint32_t min_send_len, uint32_t max_send_len,
-	void (*on_protocol_recv_cb)(sock_session_t*),
-	void (*on_protocol_ping_cb)(sock_session_t*),
-	void (*on_complate_pkg_cb)(sock_session_t*, char*, uint32_t),
-	int (*on_protocol_send_cb)(sock_session_t*, const char*, unsigned int),
-	void (*on_create_event_cb)(sock_session_t*),
-	void (*on_disconn_event_cb)(sock_session_t*),
-	void* user_data) {
+int sm_del_listen(sock_manager_t* sm, uint16_t listen_port) {
+	if (sm == 0)
+		return -1;
 
-	if (sm == 0 || fd == -1)
+	sock_session_t* pos, * n;
+	list_for_each_entry_safe(pos, n, &sm->list_listens, elem_listens) {
+		if (pos->info.port != listen_port)
+			continue;
+
+		list_del_init(&pos->elem_listens);
+		sm_ep_del_event(sm, pos, EPOLLIN);
+		printf("[%s] [%s:%d] [%s] Remove listener, port: [%d] info: [Success]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, listen_port);
+
+#ifdef SM_ENABLE_IO_URING
+		//the cancelled accept still completes with the session, sm_clear_offline releases it after that
+		if (pos->uring_inflight) {
+			pos->flag.bit_closed = ~0;
+			list_add_tail(&pos->elem_offline, &sm->list_offline);
+			sm->mng_flag.bit_closed = ~0;
+			return 0;
+		}
+#endif//SM_ENABLE_IO_URING
+
+		close(pos->fd);
+		s_free_session(sm, pos);
 		return 0;
+	}
+	return -1;
+}
+
+/**
+*	s_add_client_session - sm_add_client_session with a callback table of the manager
+*/
+static sock_session_t* s_add_client_session(sock_manager_t* sm, int fd, const char* ip, uint16_t port, session_proto_commu_t proto_commu, uint8_t enable_et, uint8_t add_online,
+	uint32_t min_recv_len, uint32_t max_recv_len, uint32_t min_send_len, uint32_t max_send_len, const sock_session_ops_t* ops, const sock_session_t* ls, void* user_data) {
 
 	sock_session_t* ss = s_cache_session(sm, min_recv_len, max_recv_len, min_send_len, max_send_len);
 	if(ss == 0)
@@ -731,12 +1867,15 @@ sock_session_t* sm_add_client_session(sock_manager_t* sm, int fd, const char* ip
 	//ss->user_data = user_data;
 	
 	ss->on_recv_cb = sm_recv;
-	ss->on_protocol_recv_cb = on_protocol_recv_cb;
-	ss->on_protocol_ping_cb = on_protocol_ping_cb;
-	ss->on_complate_pkg_cb = on_complate_pkg_cb;
-	ss->on_protocol_send_cb = on_protocol_send_cb;
-	ss->on_disconn_event_cb = on_disconn_event_cb;
-	ss->on_create_event_cb = on_create_event_cb;
+	ss->ops = ops;
+
+	//idle check and websocket extensions of the accepting listener, on_create may still change them
+	if (ls) {
+		ss->ping_interval = ls->ping_interval;
+		ss->ping_timeout = ls->ping_timeout;
+		ss->web_deflate_conf = ls->web_deflate_conf;
+		ss->web_router = ls->web_router;
+	}
 
 	int ret = sm_ep_add_event(sm, ss, EPOLLIN);
 	if (ret) {
@@ -746,62 +1885,51 @@ sock_session_t* sm_add_client_session(sock_manager_t* sm, int fd, const char* ip
 
 	if (add_online) {
 		list_add_tail(&(ss->elem_online), &(sm->list_online));
+		if (ss->ping_interval)
+			s_idle_schedule(ss, ss->last_active + ss->ping_interval);
 	}
 
-	if (ss->on_create_event_cb)
-		ss->on_create_event_cb(ss);
+	if (ss->ops->on_create_event_cb)
+		ss->ops->on_create_event_cb(ss);
 
 	return ss;
 }
 
-sock_session_t* sm_add_default_server_sessison(sock_manager_t* sm, const char* ip, uint16_t port, session_proto_commu_t proto_commu, uint8_t enable_et,
+sock_session_t* sm_add_client_session(sock_manager_t* sm, int fd, const char* ip, uint16_t port, session_proto_commu_t proto_commu ,uint8_t enable_et, uint8_t add_online,
 	uint32_t min_recv_len, uint32_t max_recv_len, uint32_t min_send_len, uint32_t max_send_len,
+	void (*on_protocol_recv_cb)(sock_session_t*),
+	void (*on_protocol_ping_cb)(sock_session_t*),
 	void (*on_complate_pkg_cb)(sock_session_t*, char*, uint32_t),
+	int (*on_protocol_send_cb)(sock_session_t*, const char*, unsigned int),
 	void (*on_create_event_cb)(sock_session_t*),
 	void (*on_disconn_event_cb)(sock_session_t*),
 	void* user_data) {
-	
-	void* cb_recv = 0, * cb_send = 0, * cb_ping = 0;
 
-	switch (proto_commu) {
-	case PROTO_COMMU_TCP_BINARY:
-		cb_recv = tcp_binary_protocol_recv;
-		cb_send = tcp_binary_protocol_send;
-		cb_ping = tcp_binary_protocol_ping;
-		break;
-	case PROTO_COMMU_TCP_JSON:
-		cb_recv = tcp_json_protocol_recv;
-		cb_send = tcp_json_protocol_send;
-		cb_ping = tcp_json_protocol_ping;
-		break;
-	case PROTO_COMMU_WEBSOCKET_BINARY:
-	case PROTO_COMMU_WEBSOCKET_JSON:
-		cb_recv = web_protocol_recv;
-		cb_send = web_protocol_send;
-		cb_ping = web_protocol_ping;
-		break;
-	}
-
-	sock_session_t* ss = sm_add_diy_server_session(sm, ip, port, enable_et, min_recv_len, max_recv_len, min_send_len, max_send_len,
-		cb_recv, cb_ping, on_complate_pkg_cb, cb_send, on_create_event_cb, on_disconn_event_cb, user_data);
+	if (sm == 0 || fd == -1)
+		return 0;
 
-	//update to param value
-	if (ss) {
-		ss->flag.bit_proto_commu = proto_commu;
-		return ss;
-	}
+	sock_session_ops_t ops = {
+		on_protocol_recv_cb,
+		on_protocol_send_cb,
+		on_protocol_ping_cb,
+		on_complate_pkg_cb,
+		on_create_event_cb,
+		on_disconn_event_cb,
+	};
+	const sock_session_ops_t* shared = s_session_ops(sm, &ops);
+	if (shared == 0)
+		return 0;
 
-	return 0;
+	return s_add_client_session(sm, fd, ip, port, proto_commu, enable_et, add_online, min_recv_len, max_recv_len, min_send_len, max_send_len, shared, 0, user_data);
 }
 
-sock_session_t* sm_add_diy_server_session(sock_manager_t* sm, const char* ip, uint16_t port, uint8_t enable_et,
+/**
+*	s_add_server_session - Connect an outbound session
+*	@url: request target of a websocket session, 0 for the other protocols
+*/
+static sock_session_t* s_add_server_session(sock_manager_t* sm, const char* ip, uint16_t port, session_proto_commu_t proto_commu, const char* url, uint8_t enable_et,
 	uint32_t min_recv_len, uint32_t max_recv_len, uint32_t min_send_len, uint32_t max_send_len,
-	void (*on_protocol_recv_cb)(sock_session_t*),
-	void (*on_protocol_ping_cb)(sock_session_t*),
-	void (*on_complate_pkg_cb)(sock_session_t*, char*, unsigned int),
-	int (*on_protocol_send_cb)(sock_session_t*, const char*, unsigned int),
-	void (*on_create_event_cb)(sock_session_t*),
-	void (*on_disconn_event_cb)(sock_session_t*),
+	const sock_session_ops_t* ops,
 	void* user_data) {
 
 	if (sm == 0)
@@ -811,20 +1939,17 @@ sock_session_t* sm_add_diy_server_session(sock_manager_t* sm, const char* ip, ui
 	int fd, ret;
 	fd = s_try_socket(AF_INET, SOCK_STREAM, 0);
 	sock_session_t* ss = s_cache_session(sm, min_recv_len, max_recv_len, min_send_len, max_send_len);
-	if (sm == 0 || fd == -1 || ss == 0)
+	if (sm == 0 || fd == -1 || ss == 0 || ops == 0)
 		goto sm_add_server_session_failed;
 
 	s_construction_session(sm, ss, fd, ip, port, enable_et, user_data);
 	ss->flag.bit_is_server = ~0;
-	ss->flag.bit_proto_commu = PROTO_COMMU_DIY;
+	ss->flag.bit_proto_commu = proto_commu;
 
 	ss->on_recv_cb = sm_recv;
-	ss->on_protocol_recv_cb = on_protocol_recv_cb;
-	ss->on_protocol_ping_cb = on_protocol_ping_cb;
-	ss->on_complate_pkg_cb = on_complate_pkg_cb;
-	ss->on_protocol_send_cb = on_protocol_send_cb;
-	ss->on_disconn_event_cb = on_disconn_event_cb;
-	ss->on_create_event_cb = on_create_event_cb;
+	ss->ops = ops;
+	if (url && web_protocol_client(ss, url))
+		goto sm_add_server_session_failed;
 
 	sin.sin_family = AF_INET;
 	sin.sin_port = htons(port);
@@ -849,12 +1974,16 @@ sock_session_t* sm_add_diy_server_session(sock_manager_t* sm, const char* ip, ui
 		goto sm_add_server_session_failed;
 	}
 
+	//a websocket client is created for the application once the upgrade completes
+	if (ss->web_client && ss->flag.bit_closed == 0 && web_protocol_connect(ss))
+		goto sm_add_server_session_failed;
+
 	//add servers list
 	list_add_tail(&(ss->elem_servers), &(sm->list_servers));
-	printf("[%s] [%s:%d] [%s] Create server session, ip: [%s], port: [%d], info: [ success ]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->ip, ss->port);
+	printf("[%s] [%s:%d] [%s] Create server session, ip: [%s], port: [%d], info: [ success ]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port);
 
-	if (ss->on_create_event_cb)
-		ss->on_create_event_cb(ss);
+	if (ss->web_client == 0 && ss->ops->on_create_event_cb)
+		ss->ops->on_create_event_cb(ss);
 
 	return ss;
 
@@ -866,10 +1995,84 @@ sm_add_server_session_failed:
 	return 0;
 }
 
+sock_session_t* sm_add_default_server_sessison(sock_manager_t* sm, const char* ip, uint16_t port, session_proto_commu_t proto_commu, uint8_t enable_et,
+	uint32_t min_recv_len, uint32_t max_recv_len, uint32_t min_send_len, uint32_t max_send_len,
+	void (*on_complate_pkg_cb)(sock_session_t*, char*, uint32_t),
+	void (*on_create_event_cb)(sock_session_t*),
+	void (*on_disconn_event_cb)(sock_session_t*),
+	void* user_data) {
+
+	if (proto_commu == PROTO_COMMU_WEBSOCKET_BINARY || proto_commu == PROTO_COMMU_WEBSOCKET_JSON)
+		return sm_add_websocket_server_session(sm, ip, port, "/", proto_commu, enable_et, min_recv_len, max_recv_len, min_send_len, max_send_len,
+			on_complate_pkg_cb, on_create_event_cb, on_disconn_event_cb, user_data);
+
+	if (sm == 0)
+		return 0;
+
+	sock_session_ops_t ops = { 0 };
+	s_protocol_ops(proto_commu, &ops);
+	ops.on_complate_pkg_cb = on_complate_pkg_cb;
+	ops.on_create_event_cb = on_create_event_cb;
+	ops.on_disconn_event_cb = on_disconn_event_cb;
+
+	return s_add_server_session(sm, ip, port, proto_commu, 0, enable_et, min_recv_len, max_recv_len, min_send_len, max_send_len, s_session_ops(sm, &ops), user_data);
+}
+
+sock_session_t* sm_add_websocket_server_session(sock_manager_t* sm, const char* ip, uint16_t port, const char* url, session_proto_commu_t proto_commu, uint8_t enable_et,
+	uint32_t min_recv_len, uint32_t max_recv_len, uint32_t min_send_len, uint32_t max_send_len,
+	void (*on_complate_pkg_cb)(sock_session_t*, char*, uint32_t),
+	void (*on_create_event_cb)(sock_session_t*),
+	void (*on_disconn_event_cb)(sock_session_t*),
+	void* user_data) {
+
+	if (sm == 0 || url == 0 || (proto_commu != PROTO_COMMU_WEBSOCKET_BINARY && proto_commu != PROTO_COMMU_WEBSOCKET_JSON))
+		return 0;
+
+	sock_session_ops_t ops = { 0 };
+	s_protocol_ops(proto_commu, &ops);
+	ops.on_complate_pkg_cb = on_complate_pkg_cb;
+	ops.on_create_event_cb = on_create_event_cb;
+	ops.on_disconn_event_cb = on_disconn_event_cb;
+
+	return s_add_server_session(sm, ip, port, proto_commu, url, enable_et, min_recv_len, max_recv_len, min_send_len, max_send_len, s_session_ops(sm, &ops), user_data);
+}
+
+sock_session_t* sm_add_diy_server_session(sock_manager_t* sm, const char* ip, uint16_t port, uint8_t enable_et,
+	uint32_t min_recv_len, uint32_t max_recv_len, uint32_t min_send_len, uint32_t max_send_len,
+	void (*on_protocol_recv_cb)(sock_session_t*),
+	void (*on_protocol_ping_cb)(sock_session_t*),
+	void (*on_complate_pkg_cb)(sock_session_t*, char*, unsigned int),
+	int (*on_protocol_send_cb)(sock_session_t*, const char*, unsigned int),
+	void (*on_create_event_cb)(sock_session_t*),
+	void (*on_disconn_event_cb)(sock_session_t*),
+	void* user_data) {
+
+	if (sm == 0)
+		return 0;
+
+	sock_session_ops_t ops = {
+		on_protocol_recv_cb,
+		on_protocol_send_cb,
+		on_protocol_ping_cb,
+		on_complate_pkg_cb,
+		on_create_event_cb,
+		on_disconn_event_cb,
+	};
+
+	return s_add_server_session(sm, ip, port, PROTO_COMMU_DIY, 0, enable_et, min_recv_len, max_recv_len, min_send_len, max_send_len, s_session_ops(sm, &ops), user_data);
+}
+
 void sm_del_session(sock_session_t* ss, uint32_t delay_destruction) {
 	if (ss == 0)
 		return;
 
+	//closed once already, a server session waiting for the reconnection only takes the new destruction time
+	if (ss->flag.bit_closed) {
+		if (ss->flag.bit_is_server)
+			ss->destruction_time = delay_destruction == -1 ? -1 : (delay_destruction ? time(0) + delay_destruction : 0);
+		return;
+	}
+
 	s_del_session(ss, delay_destruction);
 
 	/*
@@ -887,10 +2090,10 @@ void sm_del_session(sock_session_t* ss, uint32_t delay_destruction) {
 
 
 uint32_t sm_add_timer(sock_manager_t* sm, uint32_t interval_ms, uint32_t delay_ms, int32_t repeat, void(*callback_function)(uint32_t, void*), void* user_data) {
-	if (sm == 0 || sm->ht_timer == 0)
+	if (sm == 0 || sm->tw_timer == 0)
 		return -1;
 
-	return ht_add_timer(sm->ht_timer, interval_ms, delay_ms, repeat, callback_function, user_data);
+	return tw_add_timer(sm->tw_timer, interval_ms, delay_ms, repeat, callback_function, user_data);
 }
 
 /*
@@ -901,16 +2104,269 @@ void sm_del_timer(sock_manager_t* sm, uint32_t timer_id, uint32_t is_incallback)
 	if (sm == 0 || timer_id < 0)
 		return;
 
-	if (is_incallback)
-		ht_del_timer_incallback(sm->ht_timer, timer_id);
+	//the wheel deletes in O(1) and is safe inside callbacks, @is_incallback is kept for compatibility
+	tw_del_timer(sm->tw_timer, timer_id);
+}
+
+void sm_session_active(sock_session_t* ss) {
+	if (ss == 0)
+		return;
+
+	ss->last_active = time(0);
+	ss->flag.bit_ping = 0;
+
+	//the slot changes at most once per second
+	if (list_empty(&ss->elem_idle) == 0 && ss->idle_deadline != ss->last_active + ss->ping_interval)
+		s_idle_schedule(ss, ss->last_active + ss->ping_interval);
+}
+
+void sm_set_session_heart(sock_session_t* ss, uint32_t ping_interval, uint32_t ping_timeout) {
+	if (ss == 0)
+		return;
+
+	ss->ping_interval = ping_interval;
+	ss->ping_timeout = ping_timeout;
+
+	//only the online sessions are checked
+	if (ss->flag.bit_closed || list_empty(&ss->elem_online))
+		return;
+
+	if (ping_interval)
+		s_idle_schedule(ss, ss->last_active + ping_interval);
 	else
-		ht_del_timer(sm->ht_timer, timer_id);
+		list_del_init(&ss->elem_idle);
+}
+
+int sm_set_listen_heart(sock_manager_t* sm, uint16_t listen_port, uint32_t ping_interval, uint32_t ping_timeout) {
+	if (sm == 0)
+		return -1;
+
+	sock_session_t* pos, * n;
+	list_for_each_entry_safe(pos, n, &sm->list_listens, elem_listens) {
+		if (pos->info.port == listen_port) {
+			//copied to the sessions it accepts from now on
+			pos->ping_interval = ping_interval;
+			pos->ping_timeout = ping_timeout;
+			return 0;
+		}
+	}
+	return -1;
 }
 
 /*
 	źŴ
 */
 
+int sm_set_listen_deflate(sock_manager_t* sm, uint16_t listen_port, uint8_t window_bits, uint8_t no_context_takeover, uint32_t mem_cap, uint32_t threshold) {
+	if (sm == 0 || (window_bits && (window_bits < WEB_DEFLATE_MIN_BITS || window_bits > WEB_DEFLATE_MAX_BITS)))
+		return -1;
+
+	sock_session_t* pos, * n;
+	list_for_each_entry_safe(pos, n, &sm->list_listens, elem_listens) {
+		if (pos->info.port == listen_port) {
+			pos->web_deflate_conf.window_bits = window_bits;
+			pos->web_deflate_conf.no_context_takeover = no_context_takeover;
+			pos->web_deflate_conf.mem_cap = mem_cap;
+			pos->web_deflate_conf.threshold = threshold;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/**
+*	s_websock_route - A route of @router
+*	@len: path length, without the query
+*/
+static websock_protocol_t* s_websock_route(sock_websock_router_t* router, const char* path, uint32_t len, uint32_t hash) {
+	websock_protocol_t* route;
+	for (route = router->routes[hash & router->route_mask]; route; route = route->next) {
+		if (route->ws_name_hash == hash && route->ws_name_len == len && memcmp(route->ws_name, path, len) == 0)
+			return route;
+	}
+	return 0;
+}
+
+static websock_protocol_t* s_websock_new_route(const char* path, uint32_t len, session_proto_commu_t proto_commu,
+	uint32_t min_recv_len, uint32_t max_recv_len, uint32_t min_send_len, uint32_t max_send_len, const sock_session_ops_t* ops, void* user_data) {
+	websock_protocol_t* route = (websock_protocol_t*)malloc(sizeof(websock_protocol_t) + len + 1);
+	if (route == 0)
+		return 0;
+
+	route->ws_name_hash = tools_hash_func(path, len);
+	route->ws_name_len = len;
+	route->proto_commu = proto_commu;
+	route->min_recv_len = min_recv_len;
+	route->max_recv_len = max_recv_len;
+	route->min_send_len = min_send_len;
+	route->max_send_len = max_send_len;
+	route->ops = ops;
+	route->user_data = user_data;
+	route->next = 0;
+	memcpy(route->ws_name, path, len);
+	route->ws_name[len] = 0;
+	return route;
+}
+
+/**
+*	s_websock_router - Get the router of the listener @ls, create it with the service of the listener as the default route
+*/
+static sock_websock_router_t* s_websock_router(sock_manager_t* sm, sock_session_t* ls) {
+	if (ls->web_router)
+		return ls->web_router;
+
+	sock_websock_router_t* router = (sock_websock_router_t*)calloc(1, sizeof(sock_websock_router_t));
+	if (router == 0)
+		return 0;
+
+	sock_session_ops_t pending = *ls->ops;
+	pending.on_complate_pkg_cb = 0;
+	pending.on_create_event_cb = 0;
+	pending.on_disconn_event_cb = 0;
+	router->pending_ops = s_session_ops(sm, &pending);
+	router->routes = (websock_protocol_t**)calloc(MIN_WEBSOCK_ROUTE_BUCKET, sizeof(websock_protocol_t*));
+	router->route_mask = MIN_WEBSOCK_ROUTE_BUCKET - 1;
+	router->def = s_websock_new_route("", 0, ls->flag.bit_proto_commu, ls->i_buf.recv_buf_length, ls->i_buf.recv_buf_max,
+		ls->o_buf.send_buf_length, ls->o_buf.send_buf_max, ls->ops, ls->user_data);
+	if (router->pending_ops == 0 || router->routes == 0 || router->def == 0) {
+		free(router->routes);
+		free(router->def);
+		free(router);
+		return 0;
+	}
+
+	router->next = sm->router_head;
+	sm->router_head = router;
+	ls->web_router = router;
+	return router;
+}
+
+//double the buckets when they are all used on average
+static int s_websock_grow(sock_websock_router_t* router) {
+	uint32_t count = (router->route_mask + 1) << 1;
+	websock_protocol_t** routes = (websock_protocol_t**)calloc(count, sizeof(websock_protocol_t*));
+	if (routes == 0)
+		return -1;
+
+	for (uint32_t i = 0; i <= router->route_mask; ++i) {
+		while (router->routes[i]) {
+			websock_protocol_t* route = router->routes[i];
+			router->routes[i] = route->next;
+			route->next = routes[route->ws_name_hash & (count - 1)];
+			routes[route->ws_name_hash & (count - 1)] = route;
+		}
+	}
+	free(router->routes);
+	router->routes = routes;
+	router->route_mask = count - 1;
+	return 0;
+}
+
+int sm_add_websocket_route(sock_manager_t* sm, uint16_t listen_port, const char* path, session_proto_commu_t proto_commu,
+	uint32_t client_min_recv_len, uint32_t client_max_recv_len, uint32_t client_min_send_len, uint32_t client_max_send_len,
+	void (*client_on_complate_pkg_cb)(sock_session_t*, char*, uint32_t),
+	void (*client_on_create_event_cb)(sock_session_t*),
+	void (*client_on_disconn_event_cb)(sock_session_t*),
+	void* user_data) {
+	if (sm == 0 || path == 0 || path[0] != '/' || strchr(path, '?') || client_min_recv_len > client_max_recv_len || client_min_send_len > client_max_send_len)
+		return -1;
+	if (proto_commu != PROTO_COMMU_WEBSOCKET_BINARY && proto_commu != PROTO_COMMU_WEBSOCKET_JSON)
+		return -1;
+
+	sock_session_t* ls = 0, * pos, * n;
+	list_for_each_entry_safe(pos, n, &sm->list_listens, elem_listens) {
+		if (pos->info.port == listen_port) {
+			ls = pos;
+			break;
+		}
+	}
+	if (ls == 0 || ls->ops->on_protocol_recv_cb != web_protocol_recv)
+		return -1;
+
+	sock_websock_router_t* router = s_websock_router(sm, ls);
+	if (router == 0)
+		return -1;
+
+	uint32_t len = strlen(path);
+	if (s_websock_route(router, path, len, tools_hash_func(path, len)))
+		return -1;
+	if (router->route_num > router->route_mask && s_websock_grow(router))
+		return -1;
+
+	sock_session_ops_t ops = { 0 };
+	s_protocol_ops(proto_commu, &ops);
+	ops.on_complate_pkg_cb = client_on_complate_pkg_cb;
+	ops.on_create_event_cb = client_on_create_event_cb;
+	ops.on_disconn_event_cb = client_on_disconn_event_cb;
+	const sock_session_ops_t* shared_ops = s_session_ops(sm, &ops);
+	if (shared_ops == 0)
+		return -1;
+
+	websock_protocol_t* route = s_websock_new_route(path, len, proto_commu, client_min_recv_len, client_max_recv_len,
+		client_min_send_len, client_max_send_len, shared_ops, user_data);
+	if (route == 0)
+		return -1;
+
+	route->next = router->routes[route->ws_name_hash & router->route_mask];
+	router->routes[route->ws_name_hash & router->route_mask] = route;
+	router->route_num += 1;
+	return 0;
+}
+
+int sm_del_websocket_route(sock_manager_t* sm, uint16_t listen_port, const char* path) {
+	if (sm == 0 || path == 0)
+		return -1;
+
+	sock_session_t* ls = 0, * pos, * n;
+	list_for_each_entry_safe(pos, n, &sm->list_listens, elem_listens) {
+		if (pos->info.port == listen_port) {
+			ls = pos;
+			break;
+		}
+	}
+	if (ls == 0 || ls->web_router == 0)
+		return -1;
+
+	//the sessions copied the callbacks and lengths of the route, none points to it
+	sock_websock_router_t* router = ls->web_router;
+	uint32_t len = strlen(path);
+	uint32_t hash = tools_hash_func(path, len);
+	websock_protocol_t** prev = &router->routes[hash & router->route_mask];
+	for (; *prev; prev = &(*prev)->next) {
+		websock_protocol_t* route = *prev;
+		if (route->ws_name_hash == hash && route->ws_name_len == len && memcmp(route->ws_name, path, len) == 0) {
+			*prev = route->next;
+			router->route_num -= 1;
+			free(route);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int sm_websocket_route(sock_session_t* ss, const char* target, uint32_t target_len) {
+	sock_websock_router_t* router = ss->web_router;
+	if (router == 0)
+		return 0;
+
+	const char* query = (const char*)memchr(target, '?', target_len);
+	uint32_t len = query ? query - target : target_len;
+	websock_protocol_t* route = s_websock_route(router, target, len, tools_hash_func(target, len));
+	if (route == 0)
+		route = router->def;
+
+	//the handshake response is queued after the switch, into the buffer of the route
+	if (netio_ibuf_resize(&ss->i_buf, route->max_recv_len))
+		return -1;
+	ss->o_buf.send_buf_length = route->min_send_len < NETIO_OBUF_MIN_SEGMENT ? NETIO_OBUF_MIN_SEGMENT : route->min_send_len;
+	ss->o_buf.send_buf_max = route->max_send_len;
+
+	ss->flag.bit_proto_commu = route->proto_commu;
+	ss->ops = route->ops;
+	ss->user_data = route->user_data;
+	return 0;
+}
+
 int sm_add_signal(sock_manager_t* sm, uint32_t sig, void (*cb)(int)) {
 	struct sigaction new_act;
 	memset(&new_act, 0, sizeof(new_act));
@@ -931,9 +2387,18 @@ void sm_clear_offline(sock_manager_t* sm) {
 
 	sock_session_t* pos, * n;
 
+	int busy = 0;
+
 	//clean offline
 	list_for_each_entry_safe(pos,n , &sm->list_offline, elem_offline) {
-		//printf("[%s] [%s:%d] [%s] Clean offline session, ip: [%s], port: [%d] errmsg: [Active cleaning]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, pos->ip, pos->port);
+#ifdef SM_ENABLE_IO_URING
+		//the ring still holds requests of the session, release it after their completion
+		if (pos->uring_inflight) {
+			busy = 1;
+			continue;
+		}
+#endif//SM_ENABLE_IO_URING
+		//printf("[%s] [%s:%d] [%s] Clean offline session, ip: [%s], port: [%d] errmsg: [Active cleaning]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, pos->info.ip, pos->info.port);
 		list_del_init(&pos->elem_offline);
 		int ret = close(pos->fd);
 		if (ret == -1) {
@@ -945,24 +2410,301 @@ void sm_clear_offline(sock_manager_t* sm) {
 	//clean up clients that need to be shut down immediately
 	list_for_each_entry_safe(pos, n, &sm->list_servers, elem_servers) {
 		if (pos->flag.bit_closed != 0 && pos->destruction_time < time(0)) {
-			//printf("[%s] [%s:%d] [%s] Clean server session, ip: [%s], port: [%d] errmsg: [Active cleaning]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, pos->ip, pos->port);
+#ifdef SM_ENABLE_IO_URING
+			if (pos->uring_inflight) {
+				busy = 1;
+				continue;
+			}
+#endif//SM_ENABLE_IO_URING
+			//printf("[%s] [%s:%d] [%s] Clean server session, ip: [%s], port: [%d] errmsg: [Active cleaning]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, pos->info.ip, pos->info.port);
 			list_del_init(&pos->elem_servers);
 			close(pos->fd);
 			s_free_session(sm, pos);
 		}
 	}
 
-	//update manager flag
-	sm->mng_flag.bit_closed = 0;
+	//update manager flag, keep it while sessions wait for the ring
+	sm->mng_flag.bit_closed = busy ? ~0 : 0;
+}
+
+/**
+*	s_broadcast_frame - The framed @data for the protocol of @ss, encoded on first use
+*	A websocket session with permessage-deflate takes the frame compressed for its window.
+*	return 0 if the session has its own send function
+*/
+static netio_shared_t* s_broadcast_frame(sock_manager_t* sm, sock_session_t* ss, netio_shared_t** frames, const char* data, uint32_t data_len) {
+	session_proto_commu_t proto = ss->flag.bit_proto_commu;
+	uint8_t bits;
+	int idx;
+
+	switch (proto) {
+	case PROTO_COMMU_TCP_BINARY:
+		if ((void*)ss->ops->on_protocol_send_cb != (void*)tcp_binary_protocol_send)
+			return 0;
+		if (frames[proto] == 0)
+			frames[proto] = tcp_binary_protocol_encode(&sm->buf_pool, data, data_len);
+		break;
+	case PROTO_COMMU_TCP_JSON:
+		if ((void*)ss->ops->on_protocol_send_cb != (void*)tcp_json_protocol_send)
+			return 0;
+		if (frames[proto] == 0)
+			frames[proto] = tcp_json_protocol_encode(&sm->buf_pool, data, data_len);
+		break;
+	case PROTO_COMMU_WEBSOCKET_BINARY:
+	case PROTO_COMMU_WEBSOCKET_JSON:
+		//client frames are masked one by one
+		if ((void*)ss->ops->on_protocol_send_cb != (void*)web_protocol_send || ss->web_client)
+			return 0;
+		bits = web_protocol_shared_deflate(ss, data_len);
+		if (bits) {
+			idx = PROTO_COMMU_DIY + (proto - PROTO_COMMU_WEBSOCKET_BINARY) * WEB_DEFLATE_BITS_NUM + bits - WEB_DEFLATE_MIN_BITS;
+			if (frames[idx] == 0)
+				frames[idx] = web_protocol_encode_deflate(&sm->buf_pool, data, data_len, proto == PROTO_COMMU_WEBSOCKET_JSON ? 0x01 : 0x02, bits);
+		}
+		else {
+			idx = proto;
+			if (frames[idx] == 0)
+				frames[idx] = web_protocol_encode(&sm->buf_pool, data, data_len, proto == PROTO_COMMU_WEBSOCKET_JSON ? 0x01 : 0x02);
+		}
+		//a frame over the queue limit is streamed in fragments by web_protocol_send
+		if (frames[idx] && frames[idx]->length > ss->o_buf.send_buf_max)
+			return 0;
+		return frames[idx];
+	default:
+		return 0;
+	}
+	return frames[proto];
+}
+
+/**
+*	s_send_shared - Queue a reference to @sh, like the protocol send functions
+*/
+static int s_send_shared(sock_session_t* ss, netio_shared_t* sh) {
+	int ret = netio_obuf_check_full(&ss->o_buf, sh->length);
+	//the queue is full, try to send it immediately and verify it again
+	if (ret == 1) {
+		sm_send(ss);
+		if (ss->flag.bit_closed)
+			return -1;
+		ret = netio_obuf_check_full(&ss->o_buf, sh->length);
+	}
+
+	if (ret != 0 || netio_obuf_append_shared(&ss->o_buf, sh) != 0) {
+		printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, "Broadcast data out of buffer");
+		sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
+		return -1;
+	}
+	return sm_send_ready(ss);
 }
 
 void sm_broadcast_online(sock_manager_t* sm, const char* data, uint32_t data_len) {
+	if (data_len == 0)
+		return;
+
+	//framed once per protocol, the sessions only queue a reference
+	netio_shared_t* frames[MAX_BROADCAST_FRAMES] = { 0 };
+
 	sock_session_t* pos, *n;
 	list_for_each_entry_safe(pos, n, &sm->list_online, elem_online) {
-		if (pos->flag.bit_closed == 0 && pos->on_protocol_send_cb) {
-			pos->on_protocol_send_cb(pos, data, data_len);
+		if (pos->flag.bit_closed == 0 && pos->ops->on_protocol_send_cb) {
+			netio_shared_t* sh = s_broadcast_frame(sm, pos, frames, data, data_len);
+			if (sh)
+				s_send_shared(pos, sh);
+			else
+				pos->ops->on_protocol_send_cb(pos, data, data_len);
+		}
+	}
+
+	//the queues hold their own references
+	for (int i = 0; i < MAX_BROADCAST_FRAMES; ++i)
+		netio_shared_release(frames[i]);
+}
+
+int sm_group_join(sock_session_t* ss, uint32_t group_id) {
+	if (ss == 0 || ss->flag.bit_closed)
+		return -1;
+
+	sock_manager_t* sm = ss->manager_ptr;
+	for (uint16_t i = 0; i < ss->group_num; ++i) {
+		if (ss->groups[i].group->group_id == group_id)
+			return 1;
+	}
+
+	if (ss->group_num == ss->group_cap) {
+		if (ss->group_cap == 0xFFFF)
+			return -1;
+		uint32_t cap = ss->group_cap ? ss->group_cap * 2 : 4;
+		if (cap > 0xFFFF)
+			cap = 0xFFFF;
+		sock_group_ref_t* groups = (sock_group_ref_t*)realloc(ss->groups, sizeof(sock_group_ref_t) * cap);
+		if (groups == 0)
+			return -1;
+		ss->groups = groups;
+		ss->group_cap = cap;
+	}
+
+	struct rb_node** link;
+	struct rb_node* parent;
+	sock_group_t* g = s_find_group(sm, group_id, &link, &parent);
+	if (g == 0) {
+		g = (sock_group_t*)malloc(sizeof(sock_group_t));
+		if (g == 0)
+			return -1;
+		memset(g, 0, sizeof(sock_group_t));
+		g->group_id = group_id;
+		rb_link_node(&g->rb_node, parent, link);
+		rb_insert_color(&g->rb_node, &sm->group_root);
+	}
+
+	if (g->member_num == g->member_cap) {
+		uint32_t cap = g->member_cap ? g->member_cap * 2 : 8;
+		sock_session_t** members = (sock_session_t**)realloc(g->members, sizeof(sock_session_t*) * cap);
+		if (members == 0) {
+			if (g->member_num == 0 && g->busy == 0)
+				s_free_group(sm, g);
+			return -1;
+		}
+		g->members = members;
+		g->member_cap = cap;
+	}
+
+	ss->groups[ss->group_num].group = g;
+	ss->groups[ss->group_num].idx = g->member_num;
+	ss->group_num += 1;
+	g->members[g->member_num++] = ss;
+	return 0;
+}
+
+int sm_group_leave(sock_session_t* ss, uint32_t group_id) {
+	if (ss == 0)
+		return -1;
+
+	for (uint16_t i = 0; i < ss->group_num; ++i) {
+		if (ss->groups[i].group->group_id == group_id) {
+			s_group_remove(ss->manager_ptr, &ss->groups[i]);
+			ss->groups[i] = ss->groups[--ss->group_num];
+			return 0;
 		}
 	}
+	return -1;
+}
+
+uint32_t sm_group_size(sock_manager_t* sm, uint32_t group_id) {
+	if (sm == 0)
+		return 0;
+
+	sock_group_t* g = s_find_group(sm, group_id, 0, 0);
+	return g ? g->member_num : 0;
+}
+
+void sm_group_broadcast(sock_manager_t* sm, uint32_t group_id, const char* data, uint32_t data_len) {
+	if (sm == 0 || data_len == 0)
+		return;
+
+	sock_group_t* g = s_find_group(sm, group_id, 0, 0);
+	if (g == 0)
+		return;
+
+	netio_shared_t* frames[MAX_BROADCAST_FRAMES] = { 0 };
+
+	/*
+		backwards, a member removed by a failed send is replaced by the last one, which is already done.
+		The group stays alive until the end even if every member leaves
+	*/
+	g->busy += 1;
+	for (uint32_t i = g->member_num; i > 0; --i) {
+		if (i > g->member_num)
+			continue;
+
+		sock_session_t* ss = g->members[i - 1];
+		if (ss->flag.bit_closed || ss->ops->on_protocol_send_cb == 0)
+			continue;
+
+		netio_shared_t* sh = s_broadcast_frame(sm, ss, frames, data, data_len);
+		if (sh)
+			s_send_shared(ss, sh);
+		else
+			ss->ops->on_protocol_send_cb(ss, data, data_len);
+	}
+	g->busy -= 1;
+
+	if (g->member_num == 0 && g->busy == 0)
+		s_free_group(sm, g);
+
+	for (int i = 0; i < MAX_BROADCAST_FRAMES; ++i)
+		netio_shared_release(frames[i]);
+}
+
+sock_session_t* sm_session_from_handle(sock_manager_t* sm, uint64_t handle) {
+	uint32_t idx = (uint32_t)handle;
+	if (sm == 0 || idx >= sm->handle_cap)
+		return 0;
+
+	sock_handle_t* h = &sm->handles[idx];
+	if (h->gen != (uint32_t)(handle >> 32))
+		return 0;
+	return h->ss;
+}
+
+int sm_send_handle(sock_manager_t* sm, uint64_t handle, const char* data, uint32_t data_len) {
+	sock_session_t* ss = sm_session_from_handle(sm, handle);
+	if (ss == 0 || ss->flag.bit_closed || ss->ops->on_protocol_send_cb == 0)
+		return -1;
+	return ss->ops->on_protocol_send_cb(ss, data, data_len);
+}
+
+int sm_post_send(sock_session_t* ss, const char* data, uint32_t data_len) {
+	if (ss == 0 || data_len == 0)
+		return -1;
+
+	sock_command_t* cmd = s_mailbox_command(SOCK_CMD_SEND, ss, data, data_len);
+	if (cmd == 0)
+		return -1;
+	return s_mailbox_post(ss->manager_ptr, cmd);
+}
+
+int sm_post_send_handle(sock_manager_t* sm, uint64_t handle, const char* data, uint32_t data_len) {
+	if (sm == 0 || handle == 0 || data_len == 0)
+		return -1;
+
+	sock_command_t* cmd = s_mailbox_command(SOCK_CMD_SEND, 0, data, data_len);
+	if (cmd == 0)
+		return -1;
+	cmd->handle = handle;
+	return s_mailbox_post(sm, cmd);
+}
+
+int sm_post_close(sock_session_t* ss, uint32_t delay_destruction) {
+	if (ss == 0)
+		return -1;
+
+	sock_command_t* cmd = s_mailbox_command(SOCK_CMD_CLOSE, ss, 0, 0);
+	if (cmd == 0)
+		return -1;
+	cmd->delay_destruction = delay_destruction;
+	return s_mailbox_post(ss->manager_ptr, cmd);
+}
+
+int sm_post_broadcast(sock_manager_t* sm, const char* data, uint32_t data_len) {
+	if (sm == 0 || data_len == 0)
+		return -1;
+
+	sock_command_t* cmd = s_mailbox_command(SOCK_CMD_BROADCAST, 0, data, data_len);
+	if (cmd == 0)
+		return -1;
+	return s_mailbox_post(sm, cmd);
+}
+
+int sm_post_closure(sock_manager_t* sm, void (*closure)(sock_manager_t*, void*), void* user_data) {
+	if (sm == 0 || closure == 0)
+		return -1;
+
+	sock_command_t* cmd = s_mailbox_command(SOCK_CMD_CLOSURE, 0, 0, 0);
+	if (cmd == 0)
+		return -1;
+	cmd->closure = closure;
+	cmd->user_data = user_data;
+	return s_mailbox_post(sm, cmd);
 }
 
 void sm_recv(sock_session_t* ss) {
@@ -971,8 +2713,15 @@ void sm_recv(sock_session_t* ss) {
 
 	uint32_t unused_len;
 	const char* errmsg = 0;
+	int ret;
+	//the input buffer is taken from the pool when data arrives
+	if (netio_ibuf_acquire(&(ss->i_buf))) {
+		ret = 3;
+		goto sm_recv_failed;
+	}
+
 	//if input buffer full
-	int ret = netio_ibuf_check_full(&(ss->i_buf));
+	ret = netio_ibuf_check_full(&(ss->i_buf));
 	if (ret)
 		goto sm_recv_failed;
 
@@ -984,6 +2733,7 @@ void sm_recv(sock_session_t* ss) {
 			//if in the recv pending
 			if(list_empty(&ss->elem_pending_recv) == 0)
 				list_del_init(&ss->elem_pending_recv);
+			netio_ibuf_release(&(ss->i_buf));
 			return;
 		}
 		//If it is caused by interruption
@@ -1043,11 +2793,14 @@ sm_recv_failed:
 	case 2:
 		errmsg = "client disconnect";
 		break;
+	case 3:
+		errmsg = "Alloc input buffer failed";
+		break;
 	default:
 		errmsg = strerror(errno);
 	}
 
-	printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] retcode: [%d] errmsg: [%s]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->ip, ss->port, ret, errmsg);
+	printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] retcode: [%d] errmsg: [%s]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, ret, errmsg);
 	sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
 }
 
@@ -1055,11 +2808,36 @@ void sm_send(sock_session_t* ss) {
 	if (ss->flag.bit_closed)
 		return;
 
-	if (ss->o_buf.send_len) {
-		int sended = send(ss->fd, ss->o_buf.send_buf, ss->o_buf.send_len, 0);
+#ifdef SM_ENABLE_IO_URING
+	if (ss->manager_ptr->uring) {
+		s_uring_send(ss);
+		return;
+	}
+#endif//SM_ENABLE_IO_URING
+
+	//sent now, the coalesced flush has nothing left to do
+	if (list_empty(&ss->elem_dirty) == 0)
+		list_del_init(&ss->elem_dirty);
+
+	if (ss->o_buf.send_len == 0)
+		return;
+
+	//the head segments with one call, until the kernel buffer is full
+	while (ss->o_buf.send_len) {
+		struct iovec iov[MAX_SEND_IOV];
+		struct msghdr msg;
+		uint32_t iov_len = 0;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = netio_obuf_iov(&ss->o_buf, iov, MAX_SEND_IOV, &iov_len);
+
+		ssize_t sended = sendmsg(ss->fd, &msg, MSG_NOSIGNAL);
 		if (sended == -1) {
 			//If the interrupt or the kernel buffer is temporarily full
 			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				//write-first and coalesce never armed EPOLLOUT before the kernel buffer filled
+				if (errno != EINTR && (ss->manager_ptr->mng_flag.bit_write_first || ss->manager_ptr->mng_flag.bit_coalesce))
+					sm_ep_add_event(ss->manager_ptr, ss, EPOLLOUT);
 				//if (ss->elem_pending_send.next == 0)
 				if (list_empty(&ss->elem_pending_send) != 0)
 					list_add_tail(&ss->elem_pending_send, &ss->manager_ptr->list_pending_send);
@@ -1074,33 +2852,64 @@ void sm_send(sock_session_t* ss) {
 			}
 		}
 
-		//if not complated
-		if (ss->o_buf.send_len - sended) {
-			sm_ep_add_event(ss->manager_ptr, ss, EPOLLOUT);
-			//move to head
-			memmove(ss->o_buf.send_buf, ss->o_buf.send_buf + sended, ss->o_buf.send_len - sended);
-			//add send pending
-			if (list_empty(&ss->elem_pending_send) != 0)
-				list_add_tail(&ss->elem_pending_send, &ss->manager_ptr->list_pending_send);
-		}
-		//if complated
-		else {
-			sm_ep_del_event(ss->manager_ptr, ss, EPOLLOUT);
-			//remove send pending
-			if (list_empty(&ss->elem_pending_send) == 0)
-				list_del_init(&ss->elem_pending_send);
-		}
+		//sent segments go back to the pool, nothing is moved
+		netio_obuf_drain(&ss->o_buf, (uint32_t)sended);
+		if ((uint32_t)sended < iov_len)
+			break;
+	}
 
-		ss->o_buf.send_len -= sended;
+	//if not complated
+	if (ss->o_buf.send_len) {
+		sm_ep_add_event(ss->manager_ptr, ss, EPOLLOUT);
+		//add send pending
+		if (list_empty(&ss->elem_pending_send) != 0)
+			list_add_tail(&ss->elem_pending_send, &ss->manager_ptr->list_pending_send);
+	}
+	//if complated, write-first and coalesce leave EPOLLOUT to the lazy disarm in sm_run2
+	else {
+		if (ss->manager_ptr->mng_flag.bit_write_first == 0 && ss->manager_ptr->mng_flag.bit_coalesce == 0)
+			sm_ep_del_event(ss->manager_ptr, ss, EPOLLOUT);
+		//remove send pending
+		if (list_empty(&ss->elem_pending_send) == 0)
+			list_del_init(&ss->elem_pending_send);
 	}
 	return;
 
 sm_send_failed:
 	
-	printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->ip, ss->port, strerror(errno));
+	printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, strerror(errno));
 	sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
 }
 
+int sm_send_ready(sock_session_t* ss) {
+	if (ss->flag.bit_closed)
+		return -1;
+
+	sock_manager_t* sm = ss->manager_ptr;
+#ifdef SM_ENABLE_IO_URING
+	//the ring batches the sends at the end of the iteration
+	if (sm->uring)
+		return sm_ep_add_event(sm, ss, EPOLLOUT);
+#endif//SM_ENABLE_IO_URING
+
+	if (sm->mng_flag.bit_write_first == 0 && sm->mng_flag.bit_coalesce == 0)
+		return sm_ep_add_event(sm, ss, EPOLLOUT);
+
+	//data queued before is waiting for EPOLLOUT, keep the order
+	if (list_empty(&ss->elem_pending_send) == 0)
+		return 0;
+
+	//every message of this iteration leaves with one send, see sm_flush_dirty
+	if (sm->mng_flag.bit_coalesce) {
+		if (list_empty(&ss->elem_dirty) != 0)
+			list_add_tail(&ss->elem_dirty, &sm->list_dirty);
+		return 0;
+	}
+
+	sm_send(ss);
+	return ss->flag.bit_closed ? -1 : 0;
+}
+
 void sm_pending_recv(sock_manager_t* sm) {
 	if (sm == 0)
 		return;
@@ -1109,8 +2918,9 @@ void sm_pending_recv(sock_manager_t* sm) {
 	if (list_empty(&sm->list_pending_recv) == 0) {
 		list_for_each_entry_safe(pos, n, &sm->list_pending_recv, elem_pending_recv) {
 			pos->on_recv_cb(pos);
-			if (pos->on_protocol_recv_cb)
-				pos->on_protocol_recv_cb(pos);
+			if (pos->ops->on_protocol_recv_cb)
+				pos->ops->on_protocol_recv_cb(pos);
+			netio_ibuf_release(&(pos->i_buf));
 		}
 	}
 
@@ -1127,8 +2937,8 @@ void sm_pending_recv(sock_manager_t* sm) {
 
 		list_for_each_entry_safe(pos, n, &sm->list_pending_recv, elem_pending_recv) {
 			pos->on_recv_cb(pos);
-			if (pos->on_protocol_recv_cb)
-				pos->on_protocol_recv_cb(pos);
+			if (pos->ops->on_protocol_recv_cb)
+				pos->ops->on_protocol_recv_cb(pos);
 		}
 		
 	} while (try_count);
@@ -1165,9 +2975,30 @@ void sm_pending_send(sock_manager_t* sm) {
 	*/
 }
 
+void sm_flush_dirty(sock_manager_t* sm) {
+	if (sm == 0)
+		return;
+
+	sock_session_t* pos, * n;
+	if (list_empty(&sm->list_dirty) == 0) {
+		list_for_each_entry_safe(pos, n, &sm->list_dirty, elem_dirty) {
+			//sm_send takes the session off the list
+			sm_send(pos);
+		}
+	}
+}
+
 int sm_run2(sock_manager_t* sm, uint64_t us) {
+#ifdef SM_ENABLE_IO_URING
+	if (sm->uring)
+		return s_uring_run(sm, us);
+#endif//SM_ENABLE_IO_URING
+
 	struct epoll_event events[MAX_EPOLL_SIZE];
 
+	//replies of the timers ran since the last iteration must not wait for the next event
+	sm_flush_dirty(sm);
+
 	int ret = epoll_wait(sm->ep_fd, events, MAX_EPOLL_SIZE, us);
 
 	if (ret == -1) {
@@ -1179,24 +3010,31 @@ int sm_run2(sock_manager_t* sm, uint64_t us) {
 		sock_session_t* ss = (struct sock_session*) events[i].data.ptr;
 		if (events[i].events & EPOLLIN) {
 			ss->on_recv_cb(ss);
-			if (ss->i_buf.recv_len && ss->on_protocol_recv_cb) {
-				ss->on_protocol_recv_cb(ss);
+			if (ss->i_buf.recv_len && ss->ops->on_protocol_recv_cb) {
+				ss->ops->on_protocol_recv_cb(ss);
 			}
+			//everything parsed, the buffer goes back to the pool
+			netio_ibuf_release(&(ss->i_buf));
 		}
 		if (events[i].events & EPOLLOUT) {
-			sm_send(ss);
+			//lazy disarm of write-first, nothing left to send
+			if (ss->o_buf.send_len == 0 && ss->flag.bit_closed == 0)
+				sm_ep_del_event(sm, ss, EPOLLOUT);
+			else
+				sm_send(ss);
 		}
 	}
 
 	sm_pending_send(sm);
 	sm_pending_recv(sm);
+	sm_flush_dirty(sm);
 	sm_clear_offline(sm);
 	return 0;
 }
 
 int sm_run(sock_manager_t* sm) {
 	while (sm->mng_flag.bit_running) {
-		uint64_t wait_time = ht_update_timer(sm->ht_timer);
+		uint64_t wait_time = tw_update_timer(sm->tw_timer);
 
 		//signal
 		if (sm_run2(sm, wait_time) == 0) {
@@ -31,7 +31,21 @@
 */
 #define MAX_EPOLL_SIZE (512)
 
+/*
+	io_uring backend (needs liburing and linux 6.0+, link with -luring)
+	Enable it for the library and the users together, it changes the layout of sock_session_t.
+	The backend is chosen per manager at runtime with sm_set_backend, epoll stays the default.
+*/
+//#define SM_ENABLE_IO_URING
+
+#define MAX_URING_ENTRIES (4096)		//submission queue entries
+#define MAX_URING_BUF_COUNT (4096)		//provided recv buffers, power of 2
+#define MAX_URING_BUF_SIZE (4096)		//length of one provided recv buffer
+#define MAX_URING_SEND_IOV (16)			//output segments in one send request
+
 #define MAX_HEART_TIMEOUT (10)
+#define MAX_SESSION_SLAB (64)			//session objects per slab of the pool
+#define SM_CACHE_LINE (64)				//alignment of the session objects
 #define MAX_RECONN_SERVER_TIMEOUT (5)
 
 
@@ -51,6 +65,24 @@ typedef enum session_protocol_communication {
 	PROTO_COMMU_DIY,
 }session_proto_commu_t;
 
+/**
+*	I/O backend of a manager
+*/
+typedef enum sock_backend {
+	SOCK_BACKEND_EPOLL,
+	SOCK_BACKEND_IO_URING,
+}sock_backend_t;
+
+/**
+*	Session id of a manager, see sm_set_id_strategy
+*	@SOCK_ID_COUNTER: per-process random seed and a mixed counter, no syscall on accept
+*	@SOCK_ID_UUID: a random uuid per session
+*/
+typedef enum sock_id_strategy {
+	SOCK_ID_COUNTER,
+	SOCK_ID_UUID,
+}sock_id_strategy_t;
+
 typedef enum log_level {
 	LOG_LEVEL_DEBUG,
 	LOG_LEVEL_INFO,
@@ -82,10 +114,16 @@ typedef struct session_flag {
 /**
 *	@bit_closed: Does the manager contain close event
 *	@bit_running: Is the manager running
+*	@bit_reuseport: Listeners bind with SO_REUSEPORT (reactor group)
+*	@bit_write_first: Protocol sends write to the socket at once, EPOLLOUT only when the kernel buffer is full
+*	@bit_coalesce: Protocol sends are collected and flushed once per session at the end of the loop iteration
 */
 typedef struct manager_flag {
 	char bit_closed : 1;
 	char bit_running : 1;
+	char bit_reuseport : 1;
+	char bit_write_first : 1;
+	char bit_coalesce : 1;
 }manager_flag_t;
 
 struct sock_manager;
@@ -95,51 +133,99 @@ typedef struct sock_session sock_session_t;
 
 
 /**
-*	@i_buf:	input buffer module
-*	@o_buf: output buffer module, see netio_buffer.h
-*	@manager_ptr: whitch manager contains session 
-*	@on_recv_cb: readable events callback function
+*	sock_session_ops_t - Callbacks of a session, shared by all sessions with the same protocol and listener
+*	The manager keeps one read-only copy of every distinct table (see sm_add_client_session),
+*	a session only holds a pointer to it.
 *	@on_protocol_recv_cb: communication-protocol recv callback function
-*	@on_protocol_ping_cb: communication-protocol ping package function 
-*	@on_complate_pkg_cb: callback of a complate package
 *	@on_protocol_send_cb: communication-protocol send function
+*	@on_protocol_ping_cb: communication-protocol ping package function
+*	@on_complate_pkg_cb: callback of a complate package
+*	@on_create_event_cb: session after creation
 *	@on_disconn_event_cb: session before destruction
 */
+typedef struct sock_session_ops {
+	void (*on_protocol_recv_cb)(sock_session_t*);
+	int (*on_protocol_send_cb)(sock_session_t*, const char*, unsigned int);
+	void (*on_protocol_ping_cb)(sock_session_t*);
+	void (*on_complate_pkg_cb)(sock_session_t*, char*, uint32_t);
+	void (*on_create_event_cb)(sock_session_t*);
+	void (*on_disconn_event_cb)(sock_session_t*);
+}sock_session_ops_t;
+
+/**
+*	sock_session_info_t - Identity of a session, only read when connecting, logging or looking up
+*/
+typedef struct sock_session_info {
+	uint64_t		id[2];					//128 bit session id
+	uint32_t		uuid_hash;				//hash of @id
+	uint16_t		port;
+	char			ip[32];
+	char			uuid[40];				//@id formatted on demand, see sm_session_uuid
+}sock_session_info_t;
 
+/**
+*	The first cache line holds what a readable event touches (fd, flag, on_recv_cb, i_buf),
+*	the second what a send touches (ops, manager_ptr, o_buf), everything else follows.
+*	@i_buf:	input buffer module
+*	@o_buf: output buffer module, see netio_buffer.h
+*	@on_recv_cb: readable events callback function
+*	@ops: callbacks of the protocol and the application, never null
+*	@manager_ptr: whitch manager contains session 
+*	@info: identity, see sock_session_info_t
+*/
 typedef struct sock_session {
 	int32_t			fd;
 	session_flag_t	flag;		
 	int32_t			epoll_state;			//epoll state flag
-	uint64_t		last_active;			//last active time
-	uint64_t		destruction_time;		//delay destruction time
-
-	char			uuid[40];				//uuid
-	uint32_t		uuid_hash;				//uuid hash value
-
-	uint16_t		port;	
-	char			ip[32];
-
-	neti_buffer_t		i_buf;				
-	neto_buffer_t		o_buf;				
+	void (*on_recv_cb)(sock_session_t*);	
+	neti_buffer_t	i_buf;				
 
+	const sock_session_ops_t*	ops;
 	sock_manager_t*	manager_ptr;			
+	neto_buffer_t	o_buf;				
 	void*			user_data;				
 
-	void (*on_recv_cb)(sock_session_t*);	
-	void (*on_protocol_recv_cb)(sock_session_t*);	
-	void (*on_protocol_ping_cb)(sock_session_t*);	
-	void (*on_complate_pkg_cb)(sock_session_t*, char*, uint32_t);
-	int (*on_protocol_send_cb)(sock_session_t*, const char*, unsigned int);
-	void (*on_create_event_cb)(sock_session_t*);
-	void (*on_disconn_event_cb)(sock_session_t*);
+	list_head_t		elem_pending_recv;
+	list_head_t		elem_pending_send;
+	list_head_t		elem_dirty;
+	list_head_t		elem_idle;
+
+	uint64_t		last_active;			//last active time
+	uint64_t		idle_deadline;			//next idle check, see sm_set_session_heart
+	uint32_t		ping_interval;			//idle seconds before a ping, 0 no check
+	uint32_t		ping_timeout;			//seconds to wait for the pong
+	uint64_t		destruction_time;		//delay destruction time
+	uint64_t		handle;					//see sm_session_from_handle
 
 	list_head_t		elem_online;
 	list_head_t		elem_offline;
 	list_head_t		elem_servers;
 	list_head_t		elem_listens;
-	list_head_t		elem_pending_recv;
-	list_head_t		elem_pending_send;
-}sock_session_t;
+
+	//groups joined, see sm_group_join
+	struct sock_group_ref*	groups;
+	uint16_t		group_num;
+	uint16_t		group_cap;
+
+	uint32_t		web_frag_len;			//websocket: payload of the unfinished fragmented message so far
+	web_deflate_conf_t	web_deflate_conf;	//websocket: permessage-deflate offered, see sm_set_listen_deflate
+	struct web_deflate*	web_deflate;		//websocket: negotiated compression, 0 none
+	struct web_client*	web_client;			//websocket: outbound session, see sm_add_websocket_server_session
+	struct sock_websock_router*	web_router;	//websocket: path routes of the listener, see sm_add_websocket_route
+
+	sock_session_info_t	info;
+
+#ifdef SM_ENABLE_IO_URING
+	/*
+		io_uring state, the send in flight points to the head segments of o_buf,
+		the protocols only append behind them while the kernel reads them
+	*/
+	uint32_t		uring_inflight;			//requests in the ring that point to the session
+	uint32_t		uring_send_len;			//bytes of o_buf in the send in flight, 0 none
+	struct msghdr	uring_msg;
+	struct iovec	uring_iov[MAX_URING_SEND_IOV];
+#endif//SM_ENABLE_IO_URING
+}__attribute__((aligned(SM_CACHE_LINE))) sock_session_t;
 
 //typedef struct sock_manager {
 //	list_head_t list_online;
@@ -161,13 +247,26 @@ typedef struct sock_session {
 
 typedef struct sock_manager sock_manager_t;
 
-/*
-	websocket expand
+/**
+*	websock_protocol_t - A websocket service of a listener, chosen by the request path at handshake, see sm_add_websocket_route
+*	@ws_name_hash: tools_hash_func of @ws_name
+*	@ops: callbacks of the sessions upgraded on the path
+*	@next: next route of the same hash bucket
+*	@ws_name: the path, without the query
 */
-struct websock_protocol {
-	unsigned int ws_name_hash;
-	void (*ws_complate_pkg_cb)(struct sock_manager*, struct sock_session*, char*, unsigned short);
-};
+typedef struct websock_protocol {
+	uint32_t		ws_name_hash;
+	uint32_t		ws_name_len;
+	session_proto_commu_t	proto_commu;
+	uint32_t		min_recv_len;
+	uint32_t		max_recv_len;
+	uint32_t		min_send_len;
+	uint32_t		max_send_len;
+	const sock_session_ops_t*	ops;
+	void*			user_data;
+	struct websock_protocol*	next;
+	char			ws_name[];
+}websock_protocol_t;
 
 /**
 *	sm_init_manager - Initialization manager
@@ -194,6 +293,81 @@ int sm_ep_del_event(struct sock_manager* sm, struct sock_session* ss, unsigned i
 */
 void sm_set_running(sock_manager_t* sm, uint8_t running);
 
+/**
+*	sm_set_backend - Select the I/O backend of the manager
+*	Call it before adding listeners or sessions.
+*	return 0 success, or -1 for error (backend not compiled in, not supported by the kernel, or sessions exist)
+*/
+int sm_set_backend(sock_manager_t* sm, sock_backend_t backend);
+
+/**
+*	sm_set_reuseport - Listeners added after this call bind with SO_REUSEPORT,
+*	so that several managers can listen on the same port and the kernel spreads the accepts
+*	@enable: (0/~0)
+*/
+void sm_set_reuseport(sock_manager_t* sm, uint8_t enable);
+
+/**
+*	sm_set_id_strategy - How the sessions created after this call get their id (SOCK_ID_COUNTER by default)
+*	The uuid string is formatted from the id only when sm_session_uuid asks for it.
+*/
+void sm_set_id_strategy(sock_manager_t* sm, sock_id_strategy_t strategy);
+
+/**
+*	sm_set_write_first - Optimistic send mode
+*	Data appended by the protocol send functions is written to the socket directly when nothing is queued before it,
+*	EPOLLOUT is armed only when the kernel buffer fills, and disarmed lazily by the next writable event with nothing to send.
+*	This saves the epoll_ctl and the extra wakeup of every request/response.
+*	@enable: (0/~0)
+*/
+void sm_set_write_first(sock_manager_t* sm, uint8_t enable);
+
+/**
+*	sm_set_write_coalesce - User-space corking
+*	Sessions written by the protocol send functions are put on a dirty list, and the loop flushes each of them
+*	with a single send at the end of the iteration, so several small replies of one callback or a broadcast
+*	leave as full segments instead of one syscall and one packet per message.
+*	EPOLLOUT is handled like write-first, the two modes can be combined (coalesce wins).
+*	@enable: (0/~0)
+*/
+void sm_set_write_coalesce(sock_manager_t* sm, uint8_t enable);
+
+/**
+*	Session and buffer pool of a manager
+*	Session objects come from slabs of MAX_SESSION_SLAB and go back to a free list, they are freed by sm_exit_manager only.
+*	I/O buffers are recycled in power of two size classes (see netio_pool_t) up to the cache limit.
+*	@session_total: session objects owned by the manager
+*	@session_free: of them ready for reuse
+*	@session_slabs: malloc of session slabs since the start
+*	@buffer_alloc: buffers handed out by the pool
+*	@buffer_hit: of them reused without malloc
+*	@buffer_cached: bytes in the free lists
+*/
+typedef struct sm_pool_stats {
+	uint32_t session_total;
+	uint32_t session_free;
+	uint64_t session_slabs;
+	uint64_t buffer_alloc;
+	uint64_t buffer_hit;
+	uint64_t buffer_cached;
+}sm_pool_stats_t;
+
+/**
+*	sm_reserve_sessions - Preallocate the pool
+*	@session_count: free session objects to keep ready
+*	@recv_len, send_len: also cache @session_count buffers of these lengths (0 skip),
+*	use the client_max_recv_len and client_min_send_len of the listener
+*	return 0 success, or -1 for error
+*/
+int sm_reserve_sessions(sock_manager_t* sm, uint32_t session_count, uint32_t recv_len, uint32_t send_len);
+
+/**
+*	sm_set_buffer_cache - Bytes of free buffers kept for reuse, default NETIO_POOL_DEFAULT_LIMIT
+*/
+void sm_set_buffer_cache(sock_manager_t* sm, uint64_t cache_limit);
+
+void sm_get_pool_stats(sock_manager_t* sm, sm_pool_stats_t* stats);
+
 /**
 *	sm_add_defult_listen - Add a default protocol listener
 *	@listen_port: Listening port
@@ -220,6 +394,12 @@ int sm_add_diy_listen(sock_manager_t* sm, uint16_t listen_port, uint32_t max_lis
 	void (*client_on_disconn_event_cb)(sock_session_t*),
 	void* user_data);
 
+/**
+*	sm_del_listen - Close the listener on @listen_port, the sessions it accepted stay
+*	return 0 success, or -1 no listener on @listen_port
+*/
+int sm_del_listen(sock_manager_t* sm, uint16_t listen_port);
+
 /**
 *	sm_add_client_session - Add a client session
 *	return new session object, or 0 for error
@@ -245,6 +425,22 @@ sock_session_t* sm_add_default_server_sessison(sock_manager_t* sm, const char* i
 	void (*on_disconn_event_cb)(sock_session_t*),
 	void* user_data);
 
+/**
+*	sm_add_websocket_server_session - Add an outbound websocket session (client side)
+*	Every connection starts with the upgrade request of @url and checks Sec-WebSocket-Accept,
+*	on_create_event_cb runs when the server accepts (again after each reconnection) and the sends before it fail.
+*	The frames are masked, sm_add_default_server_sessison with a websocket protocol asks for "/".
+*	@url: request target, starts with '/'
+*	@proto_commu: PROTO_COMMU_WEBSOCKET_BINARY or PROTO_COMMU_WEBSOCKET_JSON
+*	return new session object, or 0 for error
+*/
+sock_session_t* sm_add_websocket_server_session(sock_manager_t* sm, const char* ip, uint16_t port, const char* url, session_proto_commu_t proto_commu, uint8_t enable_et,
+	uint32_t min_recv_len, uint32_t max_recv_len, uint32_t min_send_len, uint32_t max_send_len,
+	void (*on_complate_pkg_cb)(sock_session_t*, char*, uint32_t),
+	void (*on_create_event_cb)(sock_session_t*),
+	void (*on_disconn_event_cb)(sock_session_t*),
+	void* user_data);
+
 sock_session_t* sm_add_diy_server_session(sock_manager_t* sm, const char* ip, uint16_t port, uint8_t enable_et,
 	uint32_t min_recv_len, uint32_t max_recv_len, uint32_t min_send_len, uint32_t max_send_len,
 	void (*on_protocol_recv_cb)(sock_session_t*),
@@ -273,10 +469,74 @@ uint32_t sm_add_timer(sock_manager_t* sm, uint32_t interval_ms, uint32_t delay_m
 /**
 *	sm_del_timer - Remove a timer event
 *	@timer_id: Created by sm_add_timer
-*	@is_incallback: Call in callback function
+*	@is_incallback: Call in callback function (not needed by the timing wheel, kept for compatibility)
 */
 void sm_del_timer(sock_manager_t* sm, uint32_t timer_id, uint32_t is_incallback);
 
+/**
+*	sm_session_active - Called by the protocols on every complete package or pong,
+*	updates last_active, clears bit_ping and moves the idle deadline
+*/
+void sm_session_active(sock_session_t* ss);
+
+/**
+*	sm_set_session_heart - Idle check of an online session
+*	After @ping_interval idle seconds the protocol ping is sent, the session is removed
+*	if nothing arrives in the next @ping_timeout seconds.
+*	@ping_interval: seconds, 0 disables the check
+*	@ping_timeout: seconds
+*/
+void sm_set_session_heart(sock_session_t* ss, uint32_t ping_interval, uint32_t ping_timeout);
+
+/**
+*	sm_set_listen_heart - Idle check of the sessions accepted by a listener, see sm_set_session_heart
+*	Default is MAX_HEART_TIMEOUT for both.
+*	return 0 success, or -1 no listener on @listen_port
+*/
+int sm_set_listen_heart(sock_manager_t* sm, uint16_t listen_port, uint32_t ping_interval, uint32_t ping_timeout);
+
+/**
+*	sm_set_listen_deflate - permessage-deflate for the websocket sessions accepted by a listener, see web_deflate_conf_t
+*	The client offer is answered in the handshake, a client without the offer gets plain frames.
+*	@window_bits: 9 - 15, 0 disables it (default)
+*	@no_context_takeover: restart the compression context with every message (0/~0), less memory for worse ratio
+*	@mem_cap: zlib memory of one session in bytes, 0 no cap
+*	@threshold: messages shorter than it are sent uncompressed
+*	return 0 success, or -1 no listener on @listen_port or a bad @window_bits
+*/
+int sm_set_listen_deflate(sock_manager_t* sm, uint16_t listen_port, uint8_t window_bits, uint8_t no_context_takeover, uint32_t mem_cap, uint32_t threshold);
+
+/**
+*	sm_add_websocket_route - Serve the websocket requests of @path on a websocket listener with their own callbacks and buffers
+*	The path of the request target (the query is ignored) picks the route with one hash lookup at handshake,
+*	the paths without a route keep the callbacks of the listener.
+*	The sessions of a listener with routes are created (on_create_event_cb) when the handshake completes,
+*	a session closed before it gets no on_disconn_event_cb.
+*	@path: starts with '/', case sensitive
+*	@proto_commu: PROTO_COMMU_WEBSOCKET_BINARY or PROTO_COMMU_WEBSOCKET_JSON
+*	return 0 success, or -1 for error (no websocket listener on @listen_port, bad arguments or @path already routed)
+*/
+int sm_add_websocket_route(sock_manager_t* sm, uint16_t listen_port, const char* path, session_proto_commu_t proto_commu,
+	uint32_t client_min_recv_len, uint32_t client_max_recv_len, uint32_t client_min_send_len, uint32_t client_max_send_len,
+	void (*client_on_complate_pkg_cb)(sock_session_t*, char*, uint32_t),
+	void (*client_on_create_event_cb)(sock_session_t*),
+	void (*client_on_disconn_event_cb)(sock_session_t*),
+	void* user_data);
+
+/**
+*	sm_del_websocket_route - Remove the route of @path, its requests get the callbacks of the listener again
+*	return 0 success, or -1 @path is not routed on @listen_port
+*/
+int sm_del_websocket_route(sock_manager_t* sm, uint16_t listen_port, const char* path);
+
+/**
+*	sm_websocket_route - Called by the websocket protocol before the handshake of a routed session is answered,
+*	switches the session to the route of @target: callbacks, user_data, protocol and buffer lengths
+*	@target: request target, not terminated
+*	return 0 success, or -1 for error (the data received does not fit the buffer of the route)
+*/
+int sm_websocket_route(sock_session_t* ss, const char* target, uint32_t target_len);
+
 int sm_add_signal(sock_manager_t* sm, uint32_t sig, void (*cb)(int));
 
 /**
@@ -286,26 +546,154 @@ void sm_clear_offline(sock_manager_t* sm);
 
 /**
 *	sm_broadcast_online - Broadcast data to online session
+*	The built-in protocols frame @data once into a shared buffer and every output queue references it,
+*	sessions with their own send function still get on_protocol_send_cb.
 */
 void sm_broadcast_online(sock_manager_t* sm, const char* data, uint32_t data_len);
 
 /**
-*	sm_session_uuid - Get session uuid
+*	Groups
+*	A group is a set of sessions of one manager, named by a user chosen id. Its members are kept in one array,
+*	so sm_group_broadcast only visits the members whatever the number of online sessions.
+*	A group is created by its first member and released with its last one, a closed session leaves all its groups.
+*	Loop thread only, like sm_broadcast_online.
+*/
+
+/**
+*	sm_group_join - Add @ss to the group @group_id
+*	return 0 success, 1 already a member, or -1 for error
+*/
+int sm_group_join(sock_session_t* ss, uint32_t group_id);
+
+/**
+*	sm_group_leave - Remove @ss from the group @group_id
+*	return 0 success, or -1 not a member
+*/
+int sm_group_leave(sock_session_t* ss, uint32_t group_id);
+
+/**
+*	sm_group_size - Get the number of members of @group_id, 0 if there is no such group
+*/
+uint32_t sm_group_size(sock_manager_t* sm, uint32_t group_id);
+
+/**
+*	sm_group_broadcast - sm_broadcast_online to the members of @group_id only
+*/
+void sm_group_broadcast(sock_manager_t* sm, uint32_t group_id, const char* data, uint32_t data_len);
+
+/**
+*	sm_session_from_handle - Find the session of @handle (see sm_session_handle) in O(1)
+*	A handle is an index of the manager handle table and the generation of the slot,
+*	the generation changes when the session object is released, so a stale handle never matches a new session.
+*	Loop thread only.
+*	return session (it may be closed and waiting for its delay destruction), or 0 for a stale handle
+*/
+sock_session_t* sm_session_from_handle(sock_manager_t* sm, uint64_t handle);
+
+/**
+*	sm_send_handle - Send @data to the session of @handle with its on_protocol_send_cb, loop thread only
+*	return 0 success, or -1 for error (stale handle or closed session)
+*/
+int sm_send_handle(sock_manager_t* sm, uint64_t handle, const char* data, uint32_t data_len);
+
+/**
+*	Cross-thread commands
+*	sm_send, the protocol send functions and sm_broadcast_online may only be called in the thread of sm_run.
+*	Other threads post commands into the lock-free mailbox of the manager, the loop is woken up by an eventfd
+*	and runs the commands in batches. The data is copied, the caller may release it after the call.
+*	A session must not be destroyed before its commands ran, use a delay_destruction or the disconnect callback
+*	to tell the posting threads; a session object recycled in the meantime is detected by its handle.
+*	return 0 success, or -1 for error
+*/
+
+/**
+*	sm_post_send - Send @data to @ss with its on_protocol_send_cb, in the loop thread
+*/
+int sm_post_send(sock_session_t* ss, const char* data, uint32_t data_len);
+
+/**
+*	sm_post_send_handle - sm_send_handle in the loop thread, a stale @handle drops the data
+*/
+int sm_post_send_handle(sock_manager_t* sm, uint64_t handle, const char* data, uint32_t data_len);
+
+/**
+*	sm_post_close - sm_del_session(ss, delay_destruction) in the loop thread
+*/
+int sm_post_close(sock_session_t* ss, uint32_t delay_destruction);
+
+/**
+*	sm_post_broadcast - sm_broadcast_online in the loop thread
+*/
+int sm_post_broadcast(sock_manager_t* sm, const char* data, uint32_t data_len);
+
+/**
+*	sm_post_closure - Run @closure(sm, user_data) in the loop thread
+*/
+int sm_post_closure(sock_manager_t* sm, void (*closure)(sock_manager_t*, void*), void* user_data);
+
+/**
+*	sm_session_uuid - Get session uuid, the session id in uuid form, formatted on the first call
 *	return uuid, or null for error
 */
-static const char* sm_session_uuid(sock_session_t* ss){
+const char* sm_session_uuid(sock_session_t* ss);
+
+/**
+*	sm_session_hash - Get session uuid_hash, a hash of the session id (not of the uuid string)
+*	return uuid_hash, or 0 for error
+*/
+static inline uint32_t sm_session_hash(sock_session_t* ss) {
 	if (ss)
-		return ss->uuid;
+		return ss->info.uuid_hash;
 	return 0;
 }
 
 /**
-*	sm_session_hash - Get session uuid_hash
-*	return uuid_hash, or 0 for error
+*	sm_session_ip - Get session peer ip
+*	return ip, or null for error
+*/
+static inline const char* sm_session_ip(sock_session_t* ss) {
+	if (ss)
+		return ss->info.ip;
+	return 0;
+}
+
+/**
+*	sm_session_port - Get session peer port
+*	return port, or 0 for error
 */
-static uint32_t sm_session_hash(sock_session_t* ss) {
+static inline uint16_t sm_session_port(sock_session_t* ss) {
 	if (ss)
-		return ss->uuid_hash;
+		return ss->info.port;
+	return 0;
+}
+
+/**
+*	sm_session_send - Send @data with the protocol send function of the session
+*	return 0 success, or -1 for error
+*/
+static inline int sm_session_send(sock_session_t* ss, const char* data, uint32_t data_len) {
+	if (ss && ss->ops->on_protocol_send_cb)
+		return ss->ops->on_protocol_send_cb(ss, data, data_len);
+	return -1;
+}
+
+/**
+*	sm_session_handle - Get session handle, see sm_session_from_handle
+*	return handle, or 0 for error
+*/
+static inline uint64_t sm_session_handle(sock_session_t* ss) {
+	if (ss)
+		return ss->handle;
+	return 0;
+}
+
+/**
+*	sm_session_manager - Get the manager(loop) that owns the session
+*	return manager, or null for error
+*/
+static inline sock_manager_t* sm_session_manager(sock_session_t* ss) {
+	if (ss)
+		return ss->manager_ptr;
 	return 0;
 }
 
@@ -313,7 +701,7 @@ static uint32_t sm_session_hash(sock_session_t* ss) {
 *	sm_session_is_closed - Check whether the session is closed
 *	return ~0 disconnect, or 0 for not disconnect
 */
-static uint32_t sm_session_is_closed(sock_session_t* ss) {
+static inline uint32_t sm_session_is_closed(sock_session_t* ss) {
 	return ss->flag.bit_closed;
 }
 
@@ -321,6 +709,13 @@ void sm_recv(sock_session_t* ss);
 
 void sm_send(sock_session_t* ss);
 
+/**
+*	sm_send_ready - Called by the protocol send functions after appending to o_buf
+*	Sends at once in write-first mode, marks the session dirty in coalesce mode, otherwise arms EPOLLOUT.
+*	return 0 success, or -1 for error (the session may be closed)
+*/
+int sm_send_ready(sock_session_t* ss);
+
 /**
 *	sm_pending_recv,sm_pending_send - Handling read / write pending events
 */
@@ -328,6 +723,11 @@ void sm_pending_recv(sock_manager_t* sm);
 
 void sm_pending_send(sock_manager_t* sm);
 
+/**
+*	sm_flush_dirty - Send the output of every session marked by the coalesce mode, called by sm_run2
+*/
+void sm_flush_dirty(sock_manager_t* sm);
+
 int sm_run2(sock_manager_t* sm, uint64_t us);
 
 int sm_run(sock_manager_t* sm);
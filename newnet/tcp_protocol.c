@@ -4,6 +4,11 @@
 
 #include "../tools/basic_tools.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TCP_SCAN_X86
+#endif
+
 //binary
 void tcp_binary_protocol_recv(struct sock_session* ss) {
 	if (ss->flag.bit_closed)
@@ -14,26 +19,24 @@ void tcp_binary_protocol_recv(struct sock_session* ss) {
 	if (ss->i_buf.recv_len < type_length)
 		return;
 
+	char* data = netio_ibuf_data(&ss->i_buf);
 	uint32_t total = 0;
 	do {
 		//若剩余数据不满足一个完整的数据长度类型
 		if (ss->i_buf.recv_len - total < type_length) {
 			//若有数据已经被处理,则更改buffer
 			if (total) {
-				//还有剩余
-				if (ss->i_buf.recv_len - total)
-					memmove(ss->i_buf.recv_buf, ss->i_buf.recv_buf + total, ss->i_buf.recv_len - total);
-				ss->i_buf.recv_len -= total;
+				netio_ibuf_consume(&ss->i_buf, total);
 			}
 			break;
 		}
 
 		//typeof(s_length_type) pkg_len = *((typeof(s_length_type)*)(ss->i_buf.recv_buf + total));
-		TBINARY_LENGTH_TYPE pkg_len = *((TBINARY_LENGTH_TYPE*)(ss->i_buf.recv_buf + total));
+		TBINARY_LENGTH_TYPE pkg_len = *((TBINARY_LENGTH_TYPE*)(data + total));
 
 		//若单包长度超过最大长度-长度类型则关闭客户端
 		if (pkg_len > (ss->i_buf.recv_buf_max - type_length) || !pkg_len) {
-			printf("[%s:%d] function:[%s]  Remove session, ip: [%s], port: [%d], pkg_len: [%d], max_len: [%d], errmsg: [%s]\n", __FILENAME__, __LINE__, __FUNCTION__, ss->ip, ss->port, pkg_len, ss->i_buf.recv_buf_max, "Received an incorrect packet length");
+			printf("[%s:%d] function:[%s]  Remove session, ip: [%s], port: [%d], pkg_len: [%d], max_len: [%d], errmsg: [%s]\n", __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, pkg_len, ss->i_buf.recv_buf_max, "Received an incorrect packet length");
 			sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
 			return;
 		}
@@ -41,23 +44,22 @@ void tcp_binary_protocol_recv(struct sock_session* ss) {
 			//若已处理长度 + 当前包长度 + 当前包长类型 <= 接收长度 -> 未处理数据存在至少一个完整的数据包
 			if ((total + pkg_len + type_length) <= ss->i_buf.recv_len) {
 				//若这是一个心跳包则响应,否则回调
-				if (!(pkg_len == sizeof(pong_pkg_t) && tcp_binary_protocol_pong(ss, ss->i_buf.recv_buf + total + type_length, pkg_len) == 0)) {
-					if (ss->on_complate_pkg_cb) {
-						ss->on_complate_pkg_cb(ss, ss->i_buf.recv_buf + total + type_length, pkg_len);
-						ss->last_active = time(0);
-						ss->flag.bit_ping = 0;
+				if (!(pkg_len == sizeof(pong_pkg_t) && tcp_binary_protocol_pong(ss, data + total + type_length, pkg_len) == 0)) {
+					if (ss->ops->on_complate_pkg_cb) {
+						ss->ops->on_complate_pkg_cb(ss, data + total + type_length, pkg_len);
+						sm_session_active(ss);
 					}
 				}
+				//a send (write-first) or the callback may have closed the session, its input is gone
+				if (ss->flag.bit_closed)
+					return;
 				total += (pkg_len + type_length);
 			}
 			//若剩下的数据无法组成一个完整的包
 			else{
 				//若有数据已经被处理,则更改buffer
 				if (total) {
-					//还有剩余
-					if (ss->i_buf.recv_len - total) 
-						memmove(ss->i_buf.recv_buf, ss->i_buf.recv_buf + total, ss->i_buf.recv_len - total);
-					ss->i_buf.recv_len -= total;
+					netio_ibuf_consume(&ss->i_buf, total);
 				}
 				return;
 			}
@@ -73,66 +75,44 @@ int tcp_binary_protocol_send(struct sock_session* ss, const char* data, TBINARY_
 		return 0;
 
 	int type_length = sizeof(TBINARY_LENGTH_TYPE);
-	//主要看这个函数调用的说明, type_length * 2 预留一个接收类型长度,偷懒 防止当前缓冲区达到临界值 例如: 剩下3字节,但是需要写入4字节的&data_len 
-	//偷懒不想处理&data_len的分片
-	int ret = netio_obuf_check_full(&ss->o_buf, data_len + type_length * 2);
-	if (ret == 0) {
-		memcpy(ss->o_buf.send_buf + ss->o_buf.send_len, &data_len, type_length);
-		ss->o_buf.send_len += type_length;
-
-		memcpy(ss->o_buf.send_buf + ss->o_buf.send_len, data, data_len);
-		ss->o_buf.send_len += data_len;
-	}
-	//返回值1: 总待发送长度 大于最大长度并且小于最大长度的2倍
-	else if (ret == 1) {
-		uint32_t processed_len = 0;
-		int unused_len = netio_obuf_unused_length(&ss->o_buf);
-		//若能容纳,那么将长度及一部分数据写入缓冲区
-		if (unused_len > type_length) {
-			memcpy(ss->o_buf.send_buf + ss->o_buf.send_len, &data_len, type_length);
-			ss->o_buf.send_len += type_length;
-
-			//更新未使用的长度
-			unused_len -= type_length;
-
-			if (unused_len >= data_len) {
-				unused_len -= data_len;
-				processed_len += data_len;
-			}
-			else {
-				unused_len = 0;
-				processed_len += unused_len;
-			}
-			//将未使用的缓冲区塞满
-			memcpy(ss->o_buf.send_buf + ss->o_buf.send_len, data, processed_len);
-			ss->o_buf.send_len += processed_len;
-		}
-		//立即尝试发送
+	int ret = netio_obuf_check_full(&ss->o_buf, data_len + type_length);
+	//返回值1: 队列已满,立即尝试发送后再次校验
+	if (ret == 1) {
 		sm_send(ss);
 		//若在发送时已经被关闭
 		if (ss->flag.bit_closed) 
 			return -1;
 
-		//再次校验
-		ret = netio_obuf_check_full(&ss->o_buf, data_len - processed_len);
-		if (ret == 1) {
-			printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [Kernel buffer full ,Remaining data out of buffer, Tried, but failed]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->ip, ss->port);
+		if (netio_obuf_check_full(&ss->o_buf, data_len + type_length)) {
+			printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [Kernel buffer full ,Remaining data out of buffer, Tried, but failed]\n", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port);
 			sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);	
 			return -1;
 		}
-
-		//校验通过则将剩余数据拷贝进缓冲区
-		memcpy(ss->o_buf.send_buf + ss->o_buf.send_len, data + processed_len, data_len - processed_len);
-		ss->o_buf.send_len += (data_len - processed_len);
 	}
-	else {
+	else if (ret == -1) {
 		//打印错误
-		printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]\n ", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->ip, ss->port, "The data length exceeds twice the buffer");
+		printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]\n ", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, "The data length exceeds the buffer");
 		sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
 		return -1;
 	}
 
-	return sm_ep_add_event(ss->manager_ptr, ss, EPOLLOUT);
+	if (netio_obuf_append(&ss->o_buf, &data_len, type_length) || netio_obuf_append(&ss->o_buf, data, data_len)) {
+		printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]\n ", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, "Alloc output segment failed");
+		sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
+		return -1;
+	}
+
+	return sm_send_ready(ss);
+}
+
+struct netio_shared* tcp_binary_protocol_encode(struct netio_pool* pool, const char* data, TBINARY_LENGTH_TYPE data_len) {
+	int type_length = sizeof(TBINARY_LENGTH_TYPE);
+	netio_shared_t* sh = netio_shared_create(pool, data_len + type_length);
+	if (sh) {
+		memcpy(sh->data, &data_len, type_length);
+		memcpy(sh->data + type_length, data, data_len);
+	}
+	return sh;
 }
 
 void tcp_binary_protocol_ping(struct sock_session* ss) {
@@ -142,8 +122,8 @@ void tcp_binary_protocol_ping(struct sock_session* ss) {
 	if (ret == 0) {
 		ping_pkg_t pp;
 		pp.ping = 0xFF0DFF0AFF0DFF0A;
-		if (ss->on_protocol_send_cb) {
-			ss->on_protocol_send_cb(ss, &pp, sizeof(pp));
+		if (ss->ops->on_protocol_send_cb) {
+			ss->ops->on_protocol_send_cb(ss, &pp, sizeof(pp));
 			ss->flag.bit_ping = ~0;
 		}
 	}
@@ -158,16 +138,14 @@ int tcp_binary_protocol_pong(struct sock_session* ss, const char* heart_data, ui
 
 	//若为ping包
 	if (data_len == sizeof(ping_pkg_t) && memcmp(&pi, heart_data, data_len) == 0) {
-		if (ss->on_protocol_send_cb) {
-			ss->on_protocol_send_cb(ss, &po, sizeof(po));
+		if (ss->ops->on_protocol_send_cb) {
+			ss->ops->on_protocol_send_cb(ss, &po, sizeof(po));
 		}
-		ss->last_active = time(0);
-		ss->flag.bit_ping = 0;
+		sm_session_active(ss);
 	}
 	//若为pong包
 	else if (data_len == sizeof(pong_pkg_t) && memcmp(&po, heart_data, data_len) == 0) {
-		ss->last_active = time(0);
-		ss->flag.bit_ping = 0;
+		sm_session_active(ss);
 	}
 	else {
 		return -1;
@@ -177,47 +155,108 @@ int tcp_binary_protocol_pong(struct sock_session* ss, const char* heart_data, ui
 
 
 
+/*
+	'\n' scanners of the json line protocol, return the index of the first '\n' in [begin, end), or end.
+	The widest one the cpu supports is picked on the first call.
+*/
+static uint32_t s_scan_lf_scalar(const char* data, uint32_t begin, uint32_t end) {
+	for (; begin < end; ++begin) {
+		if (data[begin] == '\n')
+			break;
+	}
+	return begin;
+}
+
+#ifdef TCP_SCAN_X86
+__attribute__((target("sse2")))
+static uint32_t s_scan_lf_sse2(const char* data, uint32_t begin, uint32_t end) {
+	const __m128i lf = _mm_set1_epi8('\n');
+	for (; begin + 16 <= end; begin += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(data + begin));
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+		if (mask)
+			return begin + __builtin_ctz(mask);
+	}
+	return s_scan_lf_scalar(data, begin, end);
+}
+
+__attribute__((target("avx2")))
+static uint32_t s_scan_lf_avx2(const char* data, uint32_t begin, uint32_t end) {
+	const __m256i lf = _mm256_set1_epi8('\n');
+	for (; begin + 32 <= end; begin += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(data + begin));
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf));
+		if (mask)
+			return begin + __builtin_ctz(mask);
+	}
+	return s_scan_lf_sse2(data, begin, end);
+}
+#endif//TCP_SCAN_X86
+
+static uint32_t s_scan_lf_init(const char* data, uint32_t begin, uint32_t end);
+static uint32_t (*s_scan_lf)(const char*, uint32_t, uint32_t) = s_scan_lf_init;
+
+static uint32_t s_scan_lf_init(const char* data, uint32_t begin, uint32_t end) {
+	//every thread stores the same pointer
+	uint32_t (*scan)(const char*, uint32_t, uint32_t) = s_scan_lf_scalar;
+#ifdef TCP_SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		scan = s_scan_lf_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		scan = s_scan_lf_sse2;
+#endif//TCP_SCAN_X86
+	__atomic_store_n(&s_scan_lf, scan, __ATOMIC_RELAXED);
+	return scan(data, begin, end);
+}
+
+uint32_t tcp_scan_lf(const char* data, uint32_t begin, uint32_t end) {
+	return s_scan_lf(data, begin, end);
+}
+
 //json
 void tcp_json_protocol_recv(struct sock_session* ss) {
 	if (ss->flag.bit_closed || ss->i_buf.recv_len < 2)
 		return;
 
+	char* data = netio_ibuf_data(&ss->i_buf);
 	uint32_t total = 0;
-	uint32_t len = ss->i_buf.recv_idx;
-
-	//处理包长小于缓冲区已接收
-	while ((total + len) < ss->i_buf.recv_len) {
-		if (*(ss->i_buf.recv_buf + total + len) == '\n' && *(ss->i_buf.recv_buf + total + len - 1) == '\r') {
-			len += 1;
-
-			//若是ping包直接响应 否则调用用户回调
-			if (tcp_json_protocol_pong(ss, ss->i_buf.recv_buf + total, len - sizeof(char) * 2)){
-				if (ss->on_complate_pkg_cb) {
-					ss->on_complate_pkg_cb(ss, ss->i_buf.recv_buf + total, len - sizeof(char) * 2);
-					ss->last_active = time(0);
-					ss->flag.bit_ping = 0;
-				}
-			}
-
-			total += len;
-			len = 0;
+	uint32_t len = ss->i_buf.recv_len;
+	//已扫描过的数据不再扫描
+	uint32_t pos = ss->i_buf.recv_idx;
+
+	//逐个'\n'处理, 前一字节为'\r'即为包尾
+	while ((pos = s_scan_lf(data, pos, len)) < len) {
+		if (pos == total || *(data + pos - 1) != '\r') {
+			++pos;
 			continue;
 		}
-		++len;
+
+		uint32_t pkg_len = pos - 1 - total;
+		//若是ping包直接响应 否则调用用户回调
+		if (tcp_json_protocol_pong(ss, data + total, pkg_len)) {
+			if (ss->ops->on_complate_pkg_cb) {
+				ss->ops->on_complate_pkg_cb(ss, data + total, pkg_len);
+				sm_session_active(ss);
+			}
+		}
+
+		total = ++pos;
+		if (ss->flag.bit_closed)
+			break;
 	}
+	len -= total;
 
 	//如果有数据被处理
 	if (total) {
 		//保存已处理索引
-		ss->i_buf.recv_idx = ss->i_buf.recv_len = ss->i_buf.recv_len - total;
-		if (ss->i_buf.recv_len) {
-			memmove(ss->i_buf.recv_buf, ss->i_buf.recv_buf + total, ss->i_buf.recv_len);
-		}
+		netio_ibuf_consume(&ss->i_buf, total);
+		ss->i_buf.recv_idx = ss->i_buf.recv_len;
 	}
 	else {
 		//如果是数据过大
 		if (len > ss->i_buf.recv_buf_length - sizeof(char) * 2) {
-			printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]\n ", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->ip, ss->port, "Not found pkg tail");
+			printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]\n ", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, "Not found pkg tail");
 			sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
 			return;
 		}
@@ -232,52 +271,46 @@ int tcp_json_protocol_send(struct sock_session* ss, const char* data, uint32_t d
 
 	//检查发送缓冲区是否能够容纳
 	int ret = netio_obuf_check_full(&ss->o_buf, data_len + 2);
-	if (ret == 0) {
-		memcpy(ss->o_buf.send_buf + ss->o_buf.send_len, data, data_len);
-		ss->o_buf.send_len += data_len;
-
-		memcpy(ss->o_buf.send_buf + ss->o_buf.send_len, "\r\n", 2);
-		ss->o_buf.send_len += 2;
-	}
-	else if (ret == 1) {
-		uint32_t processed_len = 0;
-		uint32_t unused_len = netio_obuf_unused_length(&ss->o_buf);
-		
-		//写满缓冲区 更新已处理
-		memcpy(ss->o_buf.send_buf + ss->o_buf.send_len, data, unused_len);
-		ss->o_buf.send_len += unused_len;
-		processed_len += unused_len;
-
+	if (ret == 1) {
 		//尝试
 		sm_send(ss);
 		if (ss->flag.bit_closed)
 			return -1;
 
-		//再次校验剩余长度
-		ret = netio_obuf_check_full(&ss->o_buf, data_len - processed_len);
-		//只给一次机会,失败则放弃
-		if (ret == 1 || ret == -1) {
-			printf("[%s] [%s:%d] [%s], Remove session ip: [%s], port: [%d] errmsg: [%s]\n ", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->ip, ss->port, "Kernel buffer full ,Remaining data out of buffer, Tried, but failed");
+		//再次校验,只给一次机会,失败则放弃
+		if (netio_obuf_check_full(&ss->o_buf, data_len + 2)) {
+			printf("[%s] [%s:%d] [%s], Remove session ip: [%s], port: [%d] errmsg: [%s]\n ", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, "Kernel buffer full ,Remaining data out of buffer, Tried, but failed");
 			sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
 			return -1;
 		}
-
-		//将剩余数据拷贝进缓冲区
-		memcpy(ss->o_buf.send_buf + ss->o_buf.send_len, data + processed_len, data_len - processed_len);
-		ss->o_buf.send_len += (data_len - processed_len);
 	}
-	else {
+	else if (ret == -1) {
 		//打印错误
-		printf("[%s] [%s:%d] [%s], Remove session ip: [%s], port: [%d] errmsg: [%s]\n ", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->ip, ss->port, "Kernel buffer full ,Remaining data out of buffer");
+		printf("[%s] [%s:%d] [%s], Remove session ip: [%s], port: [%d] errmsg: [%s]\n ", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, "The data length exceeds the buffer");
 		sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
 		return -1;
 	}
-	return sm_ep_add_event(ss->manager_ptr, ss, EPOLLOUT);
+
+	if (netio_obuf_append(&ss->o_buf, data, data_len) || netio_obuf_append(&ss->o_buf, "\r\n", 2)) {
+		printf("[%s] [%s:%d] [%s], Remove session ip: [%s], port: [%d] errmsg: [%s]\n ", tools_get_time_format_string(), __FILENAME__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, "Alloc output segment failed");
+		sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
+		return -1;
+	}
+	return sm_send_ready(ss);
+}
+
+struct netio_shared* tcp_json_protocol_encode(struct netio_pool* pool, const char* data, uint32_t data_len) {
+	netio_shared_t* sh = netio_shared_create(pool, data_len + 2);
+	if (sh) {
+		memcpy(sh->data, data, data_len);
+		memcpy(sh->data + data_len, "\r\n", 2);
+	}
+	return sh;
 }
 
 void tcp_json_protocol_ping(struct sock_session* ss) {
-	if (ss->on_protocol_send_cb) {
-		int ret = ss->on_protocol_send_cb(ss, JSON_KEEPALIVE, strlen(JSON_KEEPALIVE));
+	if (ss->ops->on_protocol_send_cb) {
+		int ret = ss->ops->on_protocol_send_cb(ss, JSON_KEEPALIVE, strlen(JSON_KEEPALIVE));
 		if (ret == 0) {
 			ss->flag.bit_ping = 1;
 		}
@@ -286,8 +319,7 @@ void tcp_json_protocol_ping(struct sock_session* ss) {
 
 int tcp_json_protocol_pong(struct sock_session* ss, const char* heart_data, uint16_t data_len) {
 	if (data_len == s_json_keepalive_len && strncmp(JSON_KEEPALIVE, heart_data, s_json_keepalive_len) == 0) {
-		ss->last_active = time(0);
-		ss->flag.bit_ping = 0;
+		sm_session_active(ss);
 		return 0;
 	}
 	return -1;
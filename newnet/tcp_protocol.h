@@ -5,6 +5,8 @@
 
 struct sock_session;
 struct session_manager;
+struct netio_pool;
+struct netio_shared;
 
 typedef struct ping_pkg {
 	uint64_t ping;
@@ -37,6 +39,9 @@ void tcp_binary_protocol_ping(struct sock_session* ss);
 
 int tcp_binary_protocol_pong(struct sock_session* ss, const char* heart_data, uint16_t data_len);
 
+//frame @data once for many sessions, see netio_obuf_append_shared
+struct netio_shared* tcp_binary_protocol_encode(struct netio_pool* pool, const char* data, TBINARY_LENGTH_TYPE data_len);
+
 
 
 //json
@@ -48,6 +53,11 @@ void tcp_json_protocol_ping(struct sock_session* ss);
 
 int tcp_json_protocol_pong(struct sock_session* ss, const char* heart_data, uint16_t data_len);
 
+struct netio_shared* tcp_json_protocol_encode(struct netio_pool* pool, const char* data, uint32_t data_len);
+
+//index of the first '\n' of @data in [@begin, @end), or @end, SSE2/AVX2 chosen at runtime
+uint32_t tcp_scan_lf(const char* data, uint32_t begin, uint32_t end);
+
 
 
 #ifdef __cplusplus
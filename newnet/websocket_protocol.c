@@ -8,11 +8,28 @@
 
 
 #include <string.h>
+#include <endian.h>
 #include <sys/epoll.h>
 #include <netinet/in.h>
+#include <sys/random.h>
+#include <zlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif//__SSE2__
 
 #define RFC6455 "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
 
+#define WEB_MAX_HEAD_LEN (14)				//2 + 8 bytes length + 4 bytes mask
+#define WEB_MAX_FRAGMENT (0xFFFF)			//payload of one continuation frame of a streamed message
+#define WEB_MAX_URL_LEN (1024)				//request target
+#define WEB_MAX_HTTP_HEAD (8192)			//handshake head, the empty line included
+#define WEB_MAX_HTTP_HEADERS (64)			//header lines of a handshake head
+#define WEB_RSV1 (0x40)						//first frame of a compressed message
+#define WEB_DEFLATE_MEM_LEVEL (8)			//zlib default, lowered to fit mem_cap
+#define WEB_ZLIB_STATE (12 << 10)			//zlib state besides the windows and hash tables, both streams
+#define WEB_INFLATE_MIN (4096)				//first output buffer of an inflated message
+
 struct ws_frame_protocol {
 	char fin;
 	char opcode;
@@ -20,13 +37,146 @@ struct ws_frame_protocol {
 	char mask_code[4];
 	char head_len;
 	char* data;
-	unsigned int payload_len;
+	uint64_t payload_len;
 };
 
-static void web_decode_data(const char* mask_arr, char* data, unsigned int data_len) {
-	for (int i = 0; i < data_len; ++i) {
-		data[i] ^= mask_arr[i & 3];
+/*
+	permessage-deflate state of a session, the streams are created with the first compressed message of each direction.
+	Our compressor is "server" and the peer "client" as in RFC 7692
+*/
+typedef struct web_deflate {
+	z_stream	deflate;
+	z_stream	inflate;
+	uint32_t	threshold;
+	uint8_t		server_bits;			//window of our compressor
+	uint8_t		client_bits;			//window the peer compresses with
+	uint8_t		mem_level;
+	uint8_t		server_reset;			//server_no_context_takeover
+	uint8_t		client_reset;			//client_no_context_takeover
+	uint8_t		deflate_ready;
+	uint8_t		inflate_ready;
+	uint8_t		deflate_dirty;			//a shared frame went out in between, restart the context
+}web_deflate_t;
+
+//a part of the input buffer, not terminated
+typedef struct web_slice {
+	const char*	ptr;
+	uint32_t	len;
+}web_slice_t;
+
+#define WEB_SLICE(s) { s, sizeof(s) - 1 }
+#define WEB_SLICE_IS(sl, s) ((sl).len == sizeof(s) - 1 && strncasecmp((sl).ptr, s, sizeof(s) - 1) == 0)
+
+//headers the handshake reads
+enum web_http_header {
+	WEB_HTTP_HOST,
+	WEB_HTTP_ORIGIN,
+	WEB_HTTP_UPGRADE,
+	WEB_HTTP_CONNECTION,
+	WEB_HTTP_SEC_KEY,
+	WEB_HTTP_SEC_VERSION,
+	WEB_HTTP_SEC_EXTENSIONS,
+	WEB_HTTP_SEC_ACCEPT,
+	WEB_HTTP_HEADER_NUM,
+};
+
+static const web_slice_t s_web_http_headers[WEB_HTTP_HEADER_NUM] = {
+	WEB_SLICE("Host"),
+	WEB_SLICE("Origin"),
+	WEB_SLICE("Upgrade"),
+	WEB_SLICE("Connection"),
+	WEB_SLICE("Sec-WebSocket-Key"),
+	WEB_SLICE("Sec-WebSocket-Version"),
+	WEB_SLICE("Sec-WebSocket-Extensions"),
+	WEB_SLICE("Sec-WebSocket-Accept"),
+};
+
+//comma separated lists that may be split over several lines
+#define WEB_HTTP_LIST_HEADERS ((1 << WEB_HTTP_UPGRADE) | (1 << WEB_HTTP_CONNECTION) | (1 << WEB_HTTP_SEC_EXTENSIONS))
+
+/*
+	request or status line and the known headers of a handshake head, see web_parse_http
+	@line: method, target, version / version, status, reason
+*/
+typedef struct web_http {
+	web_slice_t	line[3];
+	web_slice_t	headers[WEB_HTTP_HEADER_NUM];
+}web_http_t;
+
+//client side of an outbound session, see web_protocol_client
+typedef struct web_client {
+	char		sec_accept[32];			//expected Sec-WebSocket-Accept of the pending upgrade
+	char		url[];
+}web_client_t;
+
+static const unsigned char s_deflate_tail[4] = { 0x00, 0x00, 0xFF, 0xFF };
+
+static int web_protocol_control(struct sock_session* ss, unsigned char opcode, const char* data, uint32_t data_len);
+
+//extended payload length, 126: 2 bytes, 127: 8 bytes, network order
+static uint64_t web_read_length(const char* frame, unsigned char len7) {
+	if (len7 == 126) {
+		uint16_t len16;
+		memcpy(&len16, frame + 2, sizeof(len16));
+		return ntohs(len16);
 	}
+	if (len7 == 127) {
+		uint64_t len64;
+		memcpy(&len64, frame + 2, sizeof(len64));
+		return be64toh(len64);
+	}
+	return len7;
+}
+
+/*
+	@dst = @src ^ mask, byte i uses mask_arr[(@mask_off + i) & 3], @dst may be @src.
+	Bytes up to a 16 byte boundary of @dst, then 16 byte lanes (SSE2) and 64 bit words,
+	with the mask rotated to the offset of the boundary, then the tail bytes
+*/
+static void web_mask_copy(const char* mask_arr, uint32_t mask_off, char* dst, const char* src, uint32_t data_len) {
+	uint32_t i = 0;
+	uint32_t head = (uint32_t)(-(uintptr_t)dst & 15);
+	if (head > data_len)
+		head = data_len;
+	for (; i < head; ++i) {
+		dst[i] = src[i] ^ mask_arr[(mask_off + i) & 3];
+	}
+
+	char mask[16];
+	for (int k = 0; k < 16; ++k) {
+		mask[k] = mask_arr[(mask_off + head + k) & 3];
+	}
+
+#ifdef __SSE2__
+	__m128i mask128 = _mm_loadu_si128((const __m128i*)mask);
+	for (; i + 16 <= data_len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		_mm_store_si128((__m128i*)(dst + i), _mm_xor_si128(v, mask128));
+	}
+#endif//__SSE2__
+
+	//the words start on a multiple of 4 from head, the rotated mask still applies
+	uint64_t mask64, word;
+	memcpy(&mask64, mask, sizeof(mask64));
+	for (; i + 8 <= data_len; i += 8) {
+		memcpy(&word, src + i, sizeof(word));
+		word ^= mask64;
+		memcpy(dst + i, &word, sizeof(word));
+	}
+
+	for (; i < data_len; ++i) {
+		dst[i] = src[i] ^ mask_arr[(mask_off + i) & 3];
+	}
+}
+
+//unmask a received payload in place
+static void web_decode_data(const char* mask_arr, char* data, unsigned int data_len) {
+	web_mask_copy(mask_arr, 0, data, data, data_len);
+}
+
+//netio_obuf_append_copy callback, masks the payload of a client frame on its way into the output segments
+static void web_mask_segment(char* dst, const char* src, uint32_t len, uint32_t offset, void* mask_arr) {
+	web_mask_copy((const char*)mask_arr, offset, dst, src, len);
 }
 
 static void web_decode_protocol(const char* frame, struct ws_frame_protocol* out_buf) {
@@ -34,7 +184,7 @@ static void web_decode_protocol(const char* frame, struct ws_frame_protocol* out
 	unsigned char msk_paylen = *(frame + 1);
 	out_buf->fin = fin_opcode & 0x80;
 	out_buf->mask = msk_paylen & 0x80;
-	out_buf->opcode = fin_opcode & 0x7F;
+	out_buf->opcode = fin_opcode & 0x0F;
 	out_buf->payload_len = msk_paylen & 0x7F;
 	out_buf->head_len = 2;
 
@@ -47,17 +197,11 @@ static void web_decode_protocol(const char* frame, struct ws_frame_protocol* out
 		out_buf->head_len += 2;
 	}
 	else if (out_buf->payload_len > 126) {
-		out_buf->head_len += 4;
+		out_buf->head_len += 8;
 	}
 
 	out_buf->data = frame + out_buf->head_len;
-
-	if (out_buf->payload_len == 126) {
-		out_buf->payload_len = ntohs(*((unsigned short*)(frame + 2)));
-	}
-	else if (out_buf->payload_len > 126) {
-		out_buf->payload_len = ntohl(*((unsigned int*)(frame + 2)));
-	}
+	out_buf->payload_len = web_read_length(frame, msk_paylen & 0x7F);
 
 	if (out_buf->mask) {
 		memcpy(out_buf->mask_code, frame + out_buf->head_len - 4, 4);
@@ -83,212 +227,539 @@ static void web_encode_protocol(char* frame, struct ws_frame_protocol* in_buf) {
 		msk_paylen |= in_buf->payload_len;
 		*encode++ = msk_paylen;
 	}
-	else if (in_buf->payload_len < 0xFFFF) {
+	else if (in_buf->payload_len <= 0xFFFF) {
 		msk_paylen |= 126;
 		*encode++ = msk_paylen;
-		*((unsigned short*)encode) = ntohs(in_buf->payload_len);
+		uint16_t len16 = htons((uint16_t)in_buf->payload_len);
+		memcpy(encode, &len16, sizeof(len16));
 		encode += 2;
 	}
 	else {
 		msk_paylen |= 127;
 		*encode++ = msk_paylen;
-		*((unsigned int*)encode) = ntohl(in_buf->payload_len);
-		encode += 4;
+		uint64_t len64 = htobe64(in_buf->payload_len);
+		memcpy(encode, &len64, sizeof(len64));
+		encode += 8;
 	}
 
 	if (in_buf->mask) {
 		memcpy(encode, in_buf->mask_code, sizeof(char) * 4);
+		encode += 4;
 	}
 	in_buf->head_len = encode - frame;
 }
 
-//合并2帧数据
-static int web_merge_protocol(struct ws_frame_protocol* in_prev_buf, struct ws_frame_protocol* in_cur_buf, unsigned char is_fin) {
-	unsigned char new_head_len = 2;
-	unsigned int new_data_len = in_prev_buf->payload_len + in_cur_buf->payload_len;
+//zlib memory of the two streams, deflate: window * 4 + hash tables, inflate: window
+static uint32_t web_deflate_memory(uint8_t server_bits, uint8_t mem_level, uint8_t client_bits) {
+	return (1u << (server_bits + 2)) + (1u << (mem_level + 9)) + (1u << client_bits) + WEB_ZLIB_STATE;
+}
 
-	if (in_prev_buf->mask) {
-		new_head_len += 4;
+//the value of a window bits parameter, quoted or not, -1 for a bad one
+static int web_deflate_bits(const char* val, unsigned int len) {
+	if (len >= 2 && val[0] == '"' && val[len - 1] == '"') {
+		++val;
+		len -= 2;
+	}
+	if (len == 0 || len > 2 || val[0] < '1' || val[0] > '9' || (len == 2 && (val[1] < '0' || val[1] > '9')))
+		return -1;
+	int bits = len == 2 ? (val[0] - '0') * 10 + val[1] - '0' : val[0] - '0';
+	return bits >= 8 && bits <= 15 ? bits : -1;
+}
+
+/*
+	accept one permessage-deflate offer of @offer (without the other offers) under the listener config,
+	@resp gets the response parameters
+	return 0 accepted, or -1 declined
+*/
+static int web_deflate_offer(struct sock_session* ss, const char* offer, unsigned int offer_len, web_deflate_t* wd, char* resp, unsigned int resp_len) {
+	const web_deflate_conf_t* conf = &ss->web_deflate_conf;
+	const char* end = offer + offer_len;
+	int server_bits = -1, client_bits = -1, server_reset = 0, client_reset = 0;
+	int client_bits_asked = 0, first = 1;
+
+	while (offer < end) {
+		const char* sep = memchr(offer, ';', end - offer);
+		if (sep == 0)
+			sep = end;
+
+		//trim the parameter
+		const char* b = offer, * e = sep;
+		while (b < e && (*b == ' ' || *b == '\t')) ++b;
+		while (e > b && (e[-1] == ' ' || e[-1] == '\t')) --e;
+		const char* eq = memchr(b, '=', e - b);
+		unsigned int name_len = (eq ? eq : e) - b;
+		while (name_len && (b[name_len - 1] == ' ' || b[name_len - 1] == '\t')) --name_len;
+		const char* val = 0;
+		unsigned int val_len = 0;
+		if (eq) {
+			val = eq + 1;
+			while (val < e && (*val == ' ' || *val == '\t')) ++val;
+			val_len = e - val;
+		}
+
+#define WEB_PARAM_IS(s) (name_len == sizeof(s) - 1 && strncasecmp(b, s, name_len) == 0)
+		if (first) {
+			if (!WEB_PARAM_IS("permessage-deflate") || eq)
+				return -1;
+			first = 0;
+		}
+		//a parameter given twice or unknown declines the offer (RFC 7692 5.1)
+		else if (WEB_PARAM_IS("server_no_context_takeover")) {
+			if (server_reset || eq)
+				return -1;
+			server_reset = 1;
+		}
+		else if (WEB_PARAM_IS("client_no_context_takeover")) {
+			if (client_reset || eq)
+				return -1;
+			client_reset = 1;
+		}
+		else if (WEB_PARAM_IS("server_max_window_bits")) {
+			if (server_bits != -1 || eq == 0 || (server_bits = web_deflate_bits(val, val_len)) == -1)
+				return -1;
+		}
+		else if (WEB_PARAM_IS("client_max_window_bits")) {
+			if (client_bits_asked || (eq && (client_bits = web_deflate_bits(val, val_len)) == -1))
+				return -1;
+			client_bits_asked = 1;
+		}
+		else {
+			return -1;
+		}
+#undef WEB_PARAM_IS
+		offer = sep + 1;
 	}
 
-	if (new_data_len > 126 && new_data_len < 0xFFFF) {
-		new_head_len += 2;
+	//zlib can not keep a raw window of 8 bits
+	if (server_bits != -1 && server_bits < WEB_DEFLATE_MIN_BITS)
+		return -1;
+
+	uint8_t sb = conf->window_bits;
+	if (server_bits != -1 && server_bits < sb)
+		sb = server_bits;
+	//without client_max_window_bits the client may use the full window
+	uint8_t cb = WEB_DEFLATE_MAX_BITS;
+	if (client_bits_asked) {
+		cb = conf->window_bits;
+		if (client_bits != -1 && client_bits < cb)
+			cb = client_bits;
 	}
-	else if (new_data_len > 0xFFFF) {
-		new_head_len += 4;
+
+	//lower the largest part until both streams fit
+	uint8_t ml = WEB_DEFLATE_MEM_LEVEL;
+	while (conf->mem_cap && web_deflate_memory(sb, ml, cb) > conf->mem_cap) {
+		if (sb > WEB_DEFLATE_MIN_BITS && sb + 2 >= ml + 9)
+			--sb;
+		else if (client_bits_asked && cb > WEB_DEFLATE_MIN_BITS && cb >= sb)
+			--cb;
+		else if (ml > 1)
+			--ml;
+		else
+			return -1;
 	}
 
-	memmove(in_prev_buf->data + in_prev_buf->payload_len, in_cur_buf->data, in_cur_buf->payload_len);
-	in_prev_buf->payload_len += (in_cur_buf->payload_len);
+	wd->server_bits = sb;
+	wd->client_bits = cb;
+	wd->mem_level = ml;
+	wd->server_reset = server_reset || conf->no_context_takeover;
+	wd->client_reset = client_reset || conf->no_context_takeover;
+
+	int n = snprintf(resp, resp_len, "permessage-deflate%s%s",
+		wd->server_reset ? "; server_no_context_takeover" : "", wd->client_reset ? "; client_no_context_takeover" : "");
+	if (server_bits != -1 || sb < WEB_DEFLATE_MAX_BITS)
+		n += snprintf(resp + n, resp_len - n, "; server_max_window_bits=%d", sb);
+	if (client_bits_asked && (client_bits != -1 || cb < WEB_DEFLATE_MAX_BITS))
+		n += snprintf(resp + n, resp_len - n, "; client_max_window_bits=%d", cb);
+	return n < resp_len ? 0 : -1;
+}
+
+/*
+	answer the Sec-WebSocket-Extensions of the client, the first permessage-deflate offer that fits the listener wins
+	return 0 and the response value in @resp, or -1 nothing negotiated
+*/
+static int web_deflate_negotiate(struct sock_session* ss, web_slice_t offers, char* resp, unsigned int resp_len) {
+	if (ss->web_deflate_conf.window_bits == 0 || offers.len == 0)
+		return -1;
 
-	if (new_head_len > in_prev_buf->head_len) {
-		memmove(in_prev_buf->data + new_head_len - in_prev_buf->head_len, in_prev_buf->data, in_prev_buf->payload_len);
+	web_deflate_t wd;
+	memset(&wd, 0, sizeof(wd));
+	const char* offer = offers.ptr, * end = offers.ptr + offers.len;
+	while (offer < end) {
+		const char* sep = memchr(offer, ',', end - offer);
+		if (sep == 0)
+			sep = end;
+		if (web_deflate_offer(ss, offer, sep - offer, &wd, resp, resp_len) == 0) {
+			web_deflate_t* p = (web_deflate_t*)malloc(sizeof(web_deflate_t));
+			if (p == 0)
+				return -1;
+			wd.threshold = ss->web_deflate_conf.threshold;
+			memcpy(p, &wd, sizeof(wd));
+			ss->web_deflate = p;
+			return 0;
+		}
+		offer = sep + 1;
 	}
+	return -1;
+}
+
+/*
+	Sec-WebSocket-Accept of @sec_key, base64(sha1(key + RFC6455))
+	@b64: at least 29 bytes
+	return 0, or -1 the key is too long
+*/
+static int web_accept_key(const char* sec_key, uint32_t key_len, char* b64) {
+	uint8_t sec_ws_key[64];
+	uint8_t sha1[24] = { 0 };
+
+	if (key_len + sizeof(RFC6455) > sizeof(sec_ws_key))
+		return -1;
+	memcpy(sec_ws_key, sec_key, key_len);
+	memcpy(sec_ws_key + key_len, RFC6455, sizeof(RFC6455));
+	sz_sha1(sec_ws_key, key_len + sizeof(RFC6455) - 1, (char*)sha1);
+	base64_encode(sha1, 20, b64);
+	return 0;
+}
 
-	if (is_fin) {
-		in_prev_buf->fin |= 0x80;
+//case insensitive search of @token in a comma separated header value
+static int web_slice_has_token(web_slice_t val, const char* token) {
+	uint32_t token_len = strlen(token);
+	const char* p = val.ptr, * end = val.ptr + val.len;
+	while (p < end) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) ++p;
+		const char* e = p;
+		while (e < end && *e != ',') ++e;
+		const char* t = e;
+		while (t > p && (t[-1] == ' ' || t[-1] == '\t')) --t;
+		if (t - p == token_len && strncasecmp(p, token, token_len) == 0)
+			return 1;
+		p = e;
 	}
-	web_encode_protocol(in_prev_buf->data - in_prev_buf->head_len, in_prev_buf);
 	return 0;
 }
 
-static int web_handshake(struct sock_manager* sm, struct sock_session* ss, const char* url, const char* host, const char* origin, const char* sec_key, const char* sec_version) {
-	char sec_ws_key[64];
-	char sha1[24] = { 0 };
-	char b64[32] = { 0 };
+/*
+	split the head of @len bytes, the empty line included, in one pass and without copy.
+	Lines end with CRLF, the first one has 3 fields split by single spaces (the last one keeps its spaces),
+	a header is a name, ':' and the value, the known names are matched case insensitive into @http.
+	return 0, or -1 for a malformed or oversized head
+*/
+static int web_parse_http(const char* data, uint32_t len, web_http_t* http) {
+	memset(http, 0, sizeof(web_http_t));
+	if (len > WEB_MAX_HTTP_HEAD)
+		return -1;
 
-	strcpy(sec_ws_key, sec_key);
-	strcat(sec_ws_key, RFC6455);
-	sz_sha1(sec_ws_key, strlen(sec_ws_key), sha1);
-	base64_encode(sha1, 20, b64);
+	uint32_t eol = tcp_scan_lf(data, 0, len);
+	if (eol >= len || eol == 0 || data[eol - 1] != '\r')
+		return -1;
+
+	const char* p = data, * end = data + eol - 1;
+	for (int i = 0; i < 3; ++i) {
+		const char* sp = i < 2 ? memchr(p, ' ', end - p) : end;
+		if (sp == 0 || (sp == p && i < 2))
+			return -1;
+		http->line[i].ptr = p;
+		http->line[i].len = sp - p;
+		if (i < 2)
+			p = sp + 1;
+	}
+
+	uint32_t pos = eol + 1, count = 0;
+	while (pos < len) {
+		eol = tcp_scan_lf(data, pos, len);
+		if (eol >= len || eol == pos || data[eol - 1] != '\r')
+			return -1;
+		//the empty line ends the head
+		if (eol == pos + 1)
+			return eol + 1 == len ? 0 : -1;
+		if (++count > WEB_MAX_HTTP_HEADERS)
+			return -1;
+
+		const char* line = data + pos;
+		const char* line_end = data + eol - 1;
+		const char* colon = memchr(line, ':', line_end - line);
+		//no folded lines and no space before the colon (RFC 7230 3.2.4)
+		if (colon == 0 || colon == line || *line == ' ' || *line == '\t' || colon[-1] == ' ' || colon[-1] == '\t')
+			return -1;
+
+		uint32_t name_len = colon - line;
+		const char* val = colon + 1;
+		while (val < line_end && (*val == ' ' || *val == '\t')) ++val;
+		while (line_end > val && (line_end[-1] == ' ' || line_end[-1] == '\t')) --line_end;
+
+		for (int h = 0; h < WEB_HTTP_HEADER_NUM; ++h) {
+			if (s_web_http_headers[h].len != name_len || strncasecmp(line, s_web_http_headers[h].ptr, name_len))
+				continue;
+			//a list header may come again, the first one is used, any other twice is refused
+			if (http->headers[h].ptr == 0) {
+				http->headers[h].ptr = val;
+				http->headers[h].len = line_end - val;
+			}
+			else if ((WEB_HTTP_LIST_HEADERS & (1 << h)) == 0) {
+				return -1;
+			}
+			break;
+		}
+		pos = eol + 1;
+	}
+	return -1;
+}
 
-	sprintf(ss->o_buf.send_buf + ss->o_buf.send_len, "HTTP/1.1 101 Switching Protocols\r\n" \
+/*
+	queue the 101 response
+	@accept: Sec-WebSocket-Accept, see web_accept_key
+	@ext: Sec-WebSocket-Extensions value, empty for none
+*/
+static int web_handshake(struct sock_manager* sm, struct sock_session* ss, const char* accept, const char* ext) {
+	char ext_line[160] = { 0 };
+	if (ext[0])
+		sprintf(ext_line, "Sec-WebSocket-Extensions: %s\r\n", ext);
+
+	char resp[384];
+	int resp_len = sprintf(resp, "HTTP/1.1 101 Switching Protocols\r\n" \
 		"Upgrade: websocket\r\n" \
 		"Connection: Upgrade\r\n" \
 		"Sec-WebSocket-Accept: %s\r\n" \
-		"\r\n", b64);
-	ss->o_buf.send_len += strlen(ss->o_buf.send_buf);
+		"%s" \
+		"\r\n", accept, ext_line);
 
-	int ret = sm_ep_add_event(sm, ss, EPOLLOUT);
+	//the send buffer may not be allocated yet
+	if (netio_obuf_check_full(&ss->o_buf, resp_len) != 0 || netio_obuf_append(&ss->o_buf, resp, resp_len) != 0)
+		return -1;
+
+	int ret = sm_send_ready(ss);
 	if (ret != 0) {
-		printf("ep_add_event(sm, ss, EPOLLOUT) failed\n");
+		printf("sm_send_ready(ss) failed\n");
 	}
 	return ret;
 	//return ep_add_event(sm, ss, EPOLLOUT);
 }
 
-void web_parse_head(struct sock_manager* sm, struct sock_session* ss, char* data, unsigned short len) {
-	unsigned int total = 0, head_idx = 0, tail_idx = 0, line_len, key_hash;
-	const char* fs_ptr = 0, * fe_ptr = 0;
+/*
+	check the upgrade request (RFC 6455 4.2.1) and answer it
+	@len: length of the head, the empty line included
+*/
+void web_parse_head(struct sock_manager* sm, struct sock_session* ss, const char* data, uint32_t len) {
+	web_http_t http;
+	const char* errmsg = "websocket handshake failed";
+
+	if (web_parse_http(data, len, &http)) {
+		errmsg = "Malformed handshake head";
+		goto handshake_failed;
+	}
 
-	char key[128];
-	char var[1024];
-	char host[128];
-	char origin[128];
-	char secwskey[128];
-	char secwsver[32];
+	if (http.line[0].len != 3 || memcmp(http.line[0].ptr, "GET", 3) || http.line[1].len > WEB_MAX_URL_LEN ||
+		http.line[2].len != 8 || strncmp(http.line[2].ptr, "HTTP/1.", 7) || http.line[2].ptr[7] < '1' || http.line[2].ptr[7] > '9')
+		goto handshake_failed;
 
-	char url[256] = { 0 };
-	char base64buf[32] = { 0 };
-	char sec_accept[32] = { 0 };
+	if (web_slice_has_token(http.headers[WEB_HTTP_UPGRADE], "websocket") == 0 ||
+		web_slice_has_token(http.headers[WEB_HTTP_CONNECTION], "Upgrade") == 0)
+		goto handshake_failed;
 
-	fs_ptr = data + total;
-	fe_ptr = strstr(fs_ptr, "\r\n");
-	line_len = fe_ptr - fs_ptr + sizeof(char) * 2;
+	//base64 of 16 bytes
+	if (http.headers[WEB_HTTP_SEC_KEY].len != 24 || WEB_SLICE_IS(http.headers[WEB_HTTP_SEC_VERSION], "13") == 0)
+		goto handshake_failed;
 
-	if (strncmp(fs_ptr, "GET", 3)) {
+	char accept[32] = { 0 };
+	char ext[128] = { 0 };
+	if (web_accept_key(http.headers[WEB_HTTP_SEC_KEY].ptr, http.headers[WEB_HTTP_SEC_KEY].len, accept))
+		goto handshake_failed;
+	if (web_deflate_negotiate(ss, http.headers[WEB_HTTP_SEC_EXTENSIONS], ext, sizeof(ext)))
+		ext[0] = 0;
+
+	//the path picks the callbacks and buffers of the session before the 101 goes out, see sm_add_websocket_route (@http is stale after it)
+	if (ss->web_router && sm_websocket_route(ss, http.line[1].ptr, http.line[1].len)) {
+		errmsg = "Route buffer too small";
 		goto handshake_failed;
 	}
-	else {
-		total += (line_len);
-		fs_ptr = strchr(fs_ptr, ' ');
-		fe_ptr = strchr(++fs_ptr, ' ');
-		if ((fe_ptr - fs_ptr) < line_len) {
-			strncpy(url, fs_ptr, fe_ptr - fs_ptr);
-		}
-		else {
-			goto handshake_failed;
-		}
+
+	//此处完成回执
+	if (web_handshake(sm, ss, accept, ext)) {
+		//write-first may already have removed the session
+		if (ss->flag.bit_closed)
+			return;
+		goto handshake_failed;
 	}
 
-	while (total < len - 2) {
-		fs_ptr = data + total;
-		fe_ptr = strchr(fs_ptr, ':');
-		if (!fs_ptr || !fe_ptr) { goto handshake_failed; }
-		strncpy(key, fs_ptr, fe_ptr - fs_ptr);
-		key[fe_ptr - fs_ptr] = 0;
+	//ss->flag |= SESSION_FLAG_HANDSHAKE;
+	//标记已经握手
+	ss->flag.bit_web_handshake = ~0;
+	//a routed session is created for the application once its route is known
+	if (ss->web_router && ss->ops->on_create_event_cb)
+		ss->ops->on_create_event_cb(ss);
 
-		fs_ptr = fe_ptr + sizeof(char) * 2;
-		fe_ptr = strstr(fs_ptr, "\r\n");
-		if (!fs_ptr || !fe_ptr) { goto handshake_failed; }
-		strncpy(var, fs_ptr, fe_ptr - fs_ptr);
-		var[fe_ptr - fs_ptr] = 0;
+	return;
 
-		//printf("key: [%s], var: [%s]\n", key, var);
-		total += (fe_ptr - data - total + sizeof(char) * 2);
+handshake_failed:
+	printf("[%s] [%s:%d] [%s] Remove session, ip: [%s] port: [%d] err_msg: [%s]\n", tools_get_time_format_string(), __FILE__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, errmsg);
+	sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
+}
 
-		key_hash = tools_hash_func(key, -1);
-		switch (key_hash) {
-		case 0x3B2793A8://Upgrade
-			if (strcmp(var, "websocket"))
-				goto handshake_failed;
-			break;
-		case 0x9CB49D90://Connection
-			if (strcmp(var, "Upgrade"))
-				goto handshake_failed;
-			break;
-		case 0x003AEEDE://Host
-			strcpy(host, var);
-			break;
-		case 0x0B36DF28://Origin
-			strcpy(origin, var);
-			break;
-		case 0x6B183CE5://Sec-WebSocket-Key
-			strcpy(secwskey, var);
-			break;
-		case 0xD388F522://Sec-WebSocket-Version
-			strcpy(secwsver, var);
-			break;
-		}//switch	
+/*
+	check the upgrade response of an outbound session (RFC 6455 4.1), the frames may follow it at once.
+	The session is created for the application (on_create_event_cb) once the upgrade completes
+*/
+static void web_parse_response(struct sock_manager* sm, struct sock_session* ss, const char* data, uint32_t len) {
+	web_client_t* wc = ss->web_client;
+	const char* errmsg = "Bad upgrade response";
+	web_http_t http;
+
+	if (web_parse_http(data, len, &http) || http.line[0].len != 8 || strncmp(http.line[0].ptr, "HTTP/1.", 7))
+		goto parse_response_failed;
+
+	if (WEB_SLICE_IS(http.line[1], "101") == 0) {
+		errmsg = "Upgrade refused";
+		goto parse_response_failed;
 	}
 
-	/*
-		此处可能后续需要对url, origin做出校验或增加url对应不同的处理回调。这将需要在sock_session或者实现一个多态的url->cb 映射
-	*/
+	if (web_slice_has_token(http.headers[WEB_HTTP_UPGRADE], "websocket") == 0 ||
+		web_slice_has_token(http.headers[WEB_HTTP_CONNECTION], "Upgrade") == 0)
+		goto parse_response_failed;
 
-	//此处完成回执
-	if (web_handshake(sm, ss, url, host, origin, secwskey, secwsver)) {
-		goto handshake_failed;
+	web_slice_t accept = http.headers[WEB_HTTP_SEC_ACCEPT];
+	if (accept.len != strlen(wc->sec_accept) || memcmp(accept.ptr, wc->sec_accept, accept.len)) {
+		errmsg = "Sec-WebSocket-Accept mismatch";
+		goto parse_response_failed;
 	}
-	else {
-		//ss->flag |= SESSION_FLAG_HANDSHAKE;
-		//标记已经握手
-		ss->flag.bit_web_handshake = ~0;
+
+	//nothing was offered, any extension is a protocol error
+	if (http.headers[WEB_HTTP_SEC_EXTENSIONS].ptr) {
+		errmsg = "Extension not offered";
+		goto parse_response_failed;
 	}
 
+	ss->flag.bit_web_handshake = ~0;
+	if (ss->ops->on_create_event_cb)
+		ss->ops->on_create_event_cb(ss);
 	return;
 
-handshake_failed:
-	printf("[%s] [%s:%d] [%s] Remove session, ip: [%s] port: [%d] err_msg: [%s]\n", tools_get_time_format_string(), __FILE__, __LINE__, __FUNCTION__, ss->ip, ss->port, "websocket handshake failed");
+parse_response_failed:
+	printf("[%s] [%s:%d] [%s] Remove session, ip: [%s] port: [%d] err_msg: [%s]\n", tools_get_time_format_string(), __FILE__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, errmsg);
 	sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
 }
 
+/*
+	hand a complete message to the application, a compressed one is inflated into a pool buffer first,
+	no longer than the input buffer max
+	return 0, or -1 for a corrupt or too long message
+*/
+static int web_complete_message(struct sock_session* ss, char compressed, char* data, uint32_t data_len) {
+	if (compressed == 0) {
+		if (ss->ops->on_complate_pkg_cb) {
+			ss->ops->on_complate_pkg_cb(ss, data, data_len);
+		}
+		return 0;
+	}
+
+	web_deflate_t* wd = ss->web_deflate;
+	z_stream* strm = &wd->inflate;
+	if (wd->inflate_ready == 0) {
+		memset(strm, 0, sizeof(z_stream));
+		if (inflateInit2(strm, -wd->client_bits) != Z_OK)
+			return -1;
+		wd->inflate_ready = 1;
+	}
+
+	//one byte over the max tells a message of exactly max from a longer one
+	uint32_t limit = ss->i_buf.recv_buf_max + 1;
+	uint64_t want = data_len < WEB_INFLATE_MIN / 4 ? WEB_INFLATE_MIN : (uint64_t)data_len * 4;
+	uint32_t cap = want < limit ? (uint32_t)want : limit;
+	netio_pool_t* pool = ss->i_buf.pool;
+	char* out = netio_pool_alloc(pool, cap);
+	if (out == 0)
+		return -1;
+
+	//the message ends with the sync flush the sender dropped (RFC 7692 7.2.2)
+	int tail = 0, ret;
+	strm->next_in = (Bytef*)data;
+	strm->avail_in = data_len;
+	strm->next_out = (Bytef*)out;
+	strm->avail_out = cap;
+	for (;;) {
+		ret = inflate(strm, Z_SYNC_FLUSH);
+		if (ret == Z_STREAM_END)
+			break;
+		if (ret != Z_OK && ret != Z_BUF_ERROR)
+			goto complete_message_failed;
+
+		if (strm->avail_out == 0) {
+			if (cap == limit)
+				goto complete_message_failed;
+			uint32_t new_cap = cap > limit / 2 ? limit : cap * 2;
+			char* p = netio_pool_realloc(pool, out, cap, new_cap);
+			if (p == 0)
+				goto complete_message_failed;
+			strm->next_out = (Bytef*)(p + (cap - strm->avail_out));
+			strm->avail_out = new_cap - cap;
+			out = p;
+			cap = new_cap;
+			continue;
+		}
+
+		if (tail)
+			break;
+		strm->next_in = (Bytef*)s_deflate_tail;
+		strm->avail_in = sizeof(s_deflate_tail);
+		tail = 1;
+	}
+
+	uint32_t out_len = cap - strm->avail_out;
+	if (out_len >= limit)
+		goto complete_message_failed;
+	//a final block ends the stream, the next message starts a new one
+	if (wd->client_reset || ret == Z_STREAM_END)
+		inflateReset(strm);
+
+	if (ss->ops->on_complate_pkg_cb) {
+		ss->ops->on_complate_pkg_cb(ss, out, out_len);
+	}
+	netio_pool_free(pool, out, cap);
+	return 0;
+
+complete_message_failed:
+	netio_pool_free(pool, out, cap);
+	return -1;
+}
+
 int web_parse_frame(struct sock_manager* sm, struct sock_session* ss) {
 	if (ss->i_buf.recv_len < 2 || ss->flag.bit_closed) { return 0; }
 
+	char* data = netio_ibuf_data(&ss->i_buf);
+	//prev_frame_idx: first frame of the unfinished message, cur_frame_idx: next frame to parse
 	unsigned int prev_frame_idx = 0, cur_frame_idx = ss->i_buf.recv_idx;
+	const char* errmsg = "The received message is too long";
 
 	do {
+		//closed by the user callback
+		if (ss->flag.bit_closed)
+			return -1;
+
 		if (ss->i_buf.recv_len - cur_frame_idx < 2) {
 		parse_frame_save_ret:
-			//ss->recv_idx = cur_frame_idx;
-			if (prev_frame_idx == cur_frame_idx) {
-				ss->i_buf.recv_len -= cur_frame_idx;
-				ss->i_buf.recv_idx -= cur_frame_idx;
-			}
-			else {
-				ss->i_buf.recv_len -= prev_frame_idx;
-				ss->i_buf.recv_idx -= prev_frame_idx;
-			}
-
-			if (prev_frame_idx && ss->i_buf.recv_len) {
-				memmove(ss->i_buf.recv_buf, ss->i_buf.recv_buf + prev_frame_idx, ss->i_buf.recv_len);
-			}
+			//drop the finished frames, the fragments of an unfinished message stay at the front
+			netio_ibuf_consume(&ss->i_buf, prev_frame_idx);
 			return 0;
 		}
 
 		struct ws_frame_protocol wfp;
 		memset(&wfp, 0, sizeof(wfp));
 
-		unsigned char fin_opcode = *(ss->i_buf.recv_buf + cur_frame_idx);
-		unsigned char msk_paylen = *(ss->i_buf.recv_buf + cur_frame_idx + 1);
+		unsigned char fin_opcode = *(data + cur_frame_idx);
+		unsigned char msk_paylen = *(data + cur_frame_idx + 1);
 		wfp.fin = fin_opcode & 0x80;
 		wfp.mask = msk_paylen & 0x80;
-		wfp.opcode = fin_opcode & 0x7F;
+		wfp.opcode = fin_opcode & 0x0F;
 		wfp.payload_len = msk_paylen & 0x7F;
-		wfp.head_len = 6;
+		wfp.head_len = wfp.mask ? 6 : 2;
 
-		if (wfp.opcode == 0x08 || !(wfp.mask)) {
+		//clients mask every frame, servers none (RFC 6455 5.1)
+		if (wfp.opcode == 0x08 || !(wfp.mask) != !(ss->web_client == 0)) {
+			errmsg = ss->web_client ? "Close or masked frame" : "Close or unmasked frame";
+			goto parse_frame2_failed;
+		}
+
+		//RSV1 only marks the first frame of a compressed message, and only with permessage-deflate
+		if ((fin_opcode & 0x70) && ((fin_opcode & 0x70) != WEB_RSV1 || ss->web_deflate == 0 || (wfp.opcode & 0x08) || wfp.opcode == 0x00)) {
+			errmsg = "Reserved bits without a negotiated extension";
 			goto parse_frame2_failed;
 		}
 
@@ -296,115 +767,116 @@ int web_parse_frame(struct sock_manager* sm, struct sock_session* ss) {
 			wfp.head_len += 2;
 		}
 		else if (wfp.payload_len > 126) {
-			wfp.head_len += 4;
+			wfp.head_len += 8;
 		}
-		wfp.data = ss->i_buf.recv_buf + cur_frame_idx + wfp.head_len;
+		wfp.data = data + cur_frame_idx + wfp.head_len;
 
 		//校验是否满足一个协议头
 		if (cur_frame_idx + wfp.head_len > ss->i_buf.recv_len) {
-			//goto parse_frame_save_ret;	//可以替换为goto
-			if (prev_frame_idx == cur_frame_idx) {
-				ss->i_buf.recv_len -= cur_frame_idx;
-				ss->i_buf.recv_idx -= cur_frame_idx;
-			}
-			else {
-				ss->i_buf.recv_len -= prev_frame_idx;
-				ss->i_buf.recv_idx -= prev_frame_idx;
-			}
-
-			if (prev_frame_idx && ss->i_buf.recv_len) {
-				memmove(ss->i_buf.recv_buf, ss->i_buf.recv_buf + prev_frame_idx, ss->i_buf.recv_len);
-			}
-			return 0;
+			goto parse_frame_save_ret;
 		}
 		else {
-			if (wfp.payload_len == 126) {
-				wfp.payload_len = ntohs(*((uint16_t*)(ss->i_buf.recv_buf + cur_frame_idx + 2)));
-			}
-			else if (wfp.payload_len > 126) {
-				wfp.payload_len = ntohl(*((uint32_t*)(ss->i_buf.recv_buf + cur_frame_idx + 2)));
-			}
+			wfp.payload_len = web_read_length(data + cur_frame_idx, msk_paylen & 0x7F);
 
 			/*
 				此处对数据长度做出管控,也可以放开限制，但是需要对应的buffer长度
 				如果需要可以修改BUF长度或修改为实时变更长度
 				优化方案：协议完成接口，要求客户端按照指定接口请求足够长的buffer以供特定的客户端使用(避免不必要的内存浪费)
 			*/
-			if (cur_frame_idx + wfp.payload_len + wfp.head_len > ss->i_buf.recv_buf_length) {
+			//64 bit lengths are compared before any sum can overflow
+			if (wfp.payload_len > ss->i_buf.recv_buf_length || cur_frame_idx + wfp.payload_len + wfp.head_len > ss->i_buf.recv_buf_length) {
 				goto parse_frame2_failed;
 			}
 
-			memcpy(wfp.mask_code, ss->i_buf.recv_buf + cur_frame_idx + wfp.head_len - 4, 4);
-
 			//包不完整
 			if (cur_frame_idx + wfp.head_len + wfp.payload_len <= ss->i_buf.recv_len) {
 				//满足包长即解码
-				web_decode_data(wfp.mask_code, wfp.data, wfp.payload_len);
+				if (wfp.mask) {
+					memcpy(wfp.mask_code, data + cur_frame_idx + wfp.head_len - 4, 4);
+					web_decode_data(wfp.mask_code, wfp.data, wfp.payload_len);
+				}
 			}
 			else {
-				return 0;
+				goto parse_frame_save_ret;
 			}
 		}
 
-		if (wfp.fin) {
-			if (prev_frame_idx == cur_frame_idx) {
-				//test
-
-				switch (wfp.opcode) {
-				case 0x01:
-				case 0x02:
-					if (ss->on_complate_pkg_cb) {
-						ss->on_complate_pkg_cb(ss, wfp.data, wfp.payload_len);
-					}
-					break;
-				case 0x0A:
-					ss->last_active = time(0);
-					ss->flag.bit_ping = 0;
-					break;
-				}
+		//control frames may arrive between the fragments of a message, they are skipped in place
+		if (wfp.opcode & 0x08) {
+			if (wfp.opcode == 0x0A)
+				sm_session_active(ss);
+			else if (wfp.opcode == 0x09 && wfp.payload_len <= 125)
+				web_protocol_control(ss, 0x0A, wfp.data, wfp.payload_len);
+			if (prev_frame_idx == cur_frame_idx)
+				prev_frame_idx += wfp.head_len + wfp.payload_len;
+			ss->i_buf.recv_idx = cur_frame_idx += wfp.head_len + wfp.payload_len;
+			continue;
+		}
 
-				//test end
+		if (prev_frame_idx == cur_frame_idx) {
+			if (wfp.opcode == 0x00) {
+				errmsg = "Continuation frame without a message";
+				goto parse_frame2_failed;
+			}
 
-				/*if (ss->complate_pkg_cb) {
-					ss->complate_pkg_cb(sm, ss, wfp.data, wfp.payload_len);
-				}*/
-				ss->i_buf.recv_idx = prev_frame_idx = cur_frame_idx = cur_frame_idx + wfp.head_len + wfp.payload_len;
+			if (wfp.fin) {
+				if (web_complete_message(ss, fin_opcode & WEB_RSV1, wfp.data, wfp.payload_len)) {
+					errmsg = "Bad compressed message";
+					goto parse_frame2_failed;
+				}
+				prev_frame_idx += wfp.head_len + wfp.payload_len;
 			}
 			else {
-				struct ws_frame_protocol prev_wfp;
-				web_decode_protocol(ss->i_buf.recv_buf + prev_frame_idx, &prev_wfp);
-				web_merge_protocol(&prev_wfp, &wfp, 1);
-				if (ss->on_complate_pkg_cb) {
-					ss->on_complate_pkg_cb(ss, prev_wfp.data, prev_wfp.payload_len);
-				}
-				ss->i_buf.recv_idx = prev_frame_idx = cur_frame_idx = cur_frame_idx + prev_wfp.head_len + wfp.payload_len;
+				//the first fragment stays where it is, the next ones are compacted behind it
+				ss->web_frag_len = wfp.payload_len;
 			}
 		}
 		else {
-			if (prev_frame_idx == cur_frame_idx) {
-				ss->i_buf.recv_idx = cur_frame_idx += (wfp.head_len + wfp.payload_len);
+			if (wfp.opcode != 0x00) {
+				errmsg = "Data frame inside a fragmented message";
+				goto parse_frame2_failed;
 			}
-			else {
-				struct ws_frame_protocol prev_wfp;
-				web_decode_protocol(ss->i_buf.recv_buf + prev_frame_idx, &prev_wfp);
-				web_merge_protocol(&prev_wfp, &wfp, 0);
-				ss->i_buf.recv_idx = cur_frame_idx = cur_frame_idx + prev_wfp.head_len + wfp.payload_len;
+
+			//each fragment is moved once, right behind the payload of the message so far
+			struct ws_frame_protocol msg;
+			web_decode_protocol(data + prev_frame_idx, &msg);
+			memmove(msg.data + ss->web_frag_len, wfp.data, wfp.payload_len);
+			ss->web_frag_len += wfp.payload_len;
+
+			if (wfp.fin) {
+				uint32_t msg_len = ss->web_frag_len;
+				ss->web_frag_len = 0;
+				//the first frame tells whether the message is compressed
+				if (web_complete_message(ss, *(data + prev_frame_idx) & WEB_RSV1, msg.data, msg_len)) {
+					errmsg = "Bad compressed message";
+					goto parse_frame2_failed;
+				}
+				prev_frame_idx = cur_frame_idx + wfp.head_len + wfp.payload_len;
 			}
 		}
+		ss->i_buf.recv_idx = cur_frame_idx += wfp.head_len + wfp.payload_len;
 	} while (1);
 
 parse_frame2_failed:
-	printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]\n ", tools_get_time_format_string(), __FILE__, __LINE__, __FUNCTION__, ss->ip, ss->port, "The received message is too long");
+	printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]\n ", tools_get_time_format_string(), __FILE__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, errmsg);
 	sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
 	return -1;
 }
 
 
+//index behind the CRLF CRLF that ends the head, 0 if it is not in [@begin, @end) yet
+static uint32_t web_head_end(const char* data, uint32_t begin, uint32_t end) {
+	for (uint32_t i = begin; (i = tcp_scan_lf(data, i, end)) < end; ++i) {
+		if (i >= 3 && data[i - 1] == '\r' && data[i - 2] == '\n' && data[i - 3] == '\r')
+			return i + 1;
+	}
+	return 0;
+}
+
 void web_protocol_recv(struct sock_session* ss) {
 	if (!(ss->i_buf.recv_len) || ss->flag.bit_closed) { return; }
 
-	unsigned total = 0;
-	unsigned int len = ss->i_buf.recv_idx;
+	char* data = netio_ibuf_data(&ss->i_buf);
 
 	if (ss->flag.bit_web_handshake) {
 		if (web_parse_frame(ss->manager_ptr, ss) != 0) {
@@ -412,84 +884,372 @@ void web_protocol_recv(struct sock_session* ss) {
 		}
 	}
 	else {
-		if (ss->i_buf.recv_len > 4) {
-			while ((total + len) < ss->i_buf.recv_len - 3) {
-				if (*((int*)(ss->i_buf.recv_buf + total + len)) == 0x0A0D0A0D) {
-					//printf("begin handshake\n");
-					web_parse_head(ss->manager_ptr, ss, ss->i_buf.recv_buf + total, len + 4);
-					//printf("end handshake\n");
-					total += (len + 4);
-					len = 0;
-					break;
-				}
-				++len;
-			}
+		//recv_idx: bytes already searched for the end of the head
+		uint32_t head_len = web_head_end(data, ss->i_buf.recv_idx, ss->i_buf.recv_len);
+		if (head_len == 0) {
+			ss->i_buf.recv_idx = ss->i_buf.recv_len;
+			if (ss->i_buf.recv_len < WEB_MAX_HTTP_HEAD)
+				return;
+		}
 
-			if (total) {
-				if (ss->i_buf.recv_len - total) {
-					memmove(ss->i_buf.recv_buf, ss->i_buf.recv_buf + total, ss->i_buf.recv_len - total);
-				}
-				ss->i_buf.recv_idx = ss->i_buf.recv_len = ss->i_buf.recv_len - total;
-			}
-			else {
-				ss->i_buf.recv_idx = len;
-			}
+		if (head_len == 0 || head_len > WEB_MAX_HTTP_HEAD) {
+			printf("[%s] [%s:%d] [%s] Remove session, ip: [%s] port: [%d] err_msg: [%s]\n", tools_get_time_format_string(), __FILE__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, "Handshake head too long");
+			sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
+			return;
+		}
+
+		if (ss->web_client)
+			web_parse_response(ss->manager_ptr, ss, data, head_len);
+		else
+			web_parse_head(ss->manager_ptr, ss, data, head_len);
+
+		//closed by a failed handshake
+		if (ss->flag.bit_closed)
+			return;
+		netio_ibuf_consume(&ss->i_buf, head_len);
+		//frames sent right behind the handshake
+		ss->i_buf.recv_idx = 0;
+		if (ss->i_buf.recv_len && ss->flag.bit_web_handshake)
+			web_parse_frame(ss->manager_ptr, ss);
+	}
+}
+
+/*
+	per-thread splitmix64 generator of the masking keys, seeded from getrandom on the first use of the thread
+*/
+static __thread uint64_t s_mask_state;
+static __thread char s_mask_seeded;
+
+static uint64_t web_mask_random() {
+	if (s_mask_seeded == 0) {
+		if (getrandom(&s_mask_state, sizeof(s_mask_state), 0) != sizeof(s_mask_state)) {
+			uint64_t id[2];
+			tools_get_random_id(id);
+			s_mask_state = id[0] ^ id[1];
+		}
+		s_mask_seeded = 1;
+	}
+
+	uint64_t x = (s_mask_state += 0x9E3779B97F4A7C15ULL);
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+//a fresh masking key for every client frame (RFC 6455 5.3)
+static void web_mask_key(char* mask_code) {
+	uint32_t key = (uint32_t)(web_mask_random() >> 32);
+	memcpy(mask_code, &key, 4);
+}
+
+//append one frame, the caller has checked the output buffer
+//frames of an outbound session are masked, the payload while it is copied to the output segments
+static int web_append_frame(struct sock_session* ss, unsigned char opcode, char fin, const char* data, uint32_t data_len) {
+	struct ws_frame_protocol wfp;
+	memset(&wfp, 0, sizeof(wfp));
+	wfp.fin = fin;
+	wfp.mask = ss->web_client != 0;
+	wfp.opcode = opcode;
+	wfp.payload_len = data_len;
+	if (wfp.mask)
+		web_mask_key(wfp.mask_code);
+
+	char head[WEB_MAX_HEAD_LEN];
+	web_encode_protocol(head, &wfp);
+	if (netio_obuf_append(&ss->o_buf, head, wfp.head_len) ||
+		netio_obuf_append_copy(&ss->o_buf, data, data_len, wfp.mask ? web_mask_segment : 0, wfp.mask_code)) {
+		printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]\n ", tools_get_time_format_string(), __FILE__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, "Alloc output segment failed");
+		sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+	a message larger than the output buffer goes out as a first frame and continuation frames,
+	the socket is written whenever the next frame does not fit, the frames the kernel can not take yet stay queued.
+	Only the message itself may carry the queue past send_buf_max, the next send then sees a full buffer.
+*/
+static int web_stream_message(struct sock_session* ss, unsigned char opcode, const char* data, uint32_t data_len) {
+	uint32_t fragment = ss->o_buf.send_buf_max / 2;
+	if (fragment > WEB_MAX_FRAGMENT)
+		fragment = WEB_MAX_FRAGMENT;
+	if (fragment <= WEB_MAX_HEAD_LEN)
+		fragment = WEB_MAX_HEAD_LEN + 1;
+	fragment -= WEB_MAX_HEAD_LEN;
+
+	uint32_t offset = 0;
+	while (offset < data_len) {
+		uint32_t len = data_len - offset;
+		if (len > fragment)
+			len = fragment;
+
+		if (netio_obuf_check_full(&ss->o_buf, len + WEB_MAX_HEAD_LEN)) {
+			sm_send(ss);
+			if (ss->flag.bit_closed)
+				return -1;
 		}
+
+		if (web_append_frame(ss, offset ? 0x00 : opcode, offset + len == data_len, data + offset, len))
+			return -1;
+		offset += len;
 	}
+	return sm_send_ready(ss);
 }
 
-int web_protocol_send(struct sock_session* ss, const char* data, unsigned short data_len) {
+static int web_send_message(struct sock_session* ss, unsigned char opcode, const char* data, uint32_t data_len) {
 	unsigned int head_len = 0;
 	if (data_len < 126) {
 		head_len += 2;
 	}
-	else if (data_len < 0xFFFF) {
+	else if (data_len <= 0xFFFF) {
 		head_len += 4;
 	}
 	else {
-		head_len += 6;
+		head_len += 10;
 	}
-
-	/*
-		此处不考虑考虑数据撑爆缓冲区，即始终为fin,若需要发送大量数据，可以扩大缓冲区或做
-	*/
+	if (ss->web_client)
+		head_len += 4;
 
 	int ret = netio_obuf_check_full(&ss->o_buf, data_len + head_len);
-	//此处暂时不考虑数据截断,在默认最大缓冲区内工作,主要是代码太久,不知道自己的代码在干嘛了,得看着协议重新走一遍
+	if (ret == 1) {
+		//尝试
+		sm_send(ss);
+		if (ss->flag.bit_closed)
+			return -1;
+		ret = netio_obuf_check_full(&ss->o_buf, data_len + head_len);
+	}
+
+	//larger than the whole output buffer, streamed unless a previous stream still holds the queue over its max
+	if (ret == -1) {
+		if (ss->o_buf.send_len) {
+			sm_send(ss);
+			if (ss->flag.bit_closed)
+				return -1;
+		}
+		if (ss->o_buf.send_len < ss->o_buf.send_buf_max)
+			return web_stream_message(ss, opcode, data, data_len);
+	}
+
 	if (ret != 0) {
-		printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]\n ", tools_get_time_format_string(), __FILE__, __LINE__, __FUNCTION__, ss->ip, ss->port, "The data length exceeds twice the buffer");
+		printf("[%s] [%s:%d] [%s] Remove session, ip: [%s], port: [%d] errmsg: [%s]\n ", tools_get_time_format_string(), __FILE__, __LINE__, __FUNCTION__, ss->info.ip, ss->info.port, "Kernel buffer full ,Remaining data out of buffer, Tried, but failed");
 		sm_del_session(ss, ss->flag.bit_is_server ? -1 : 0);
 		return -1;
 	}
 
+	if (web_append_frame(ss, opcode, 1, data, data_len))
+		return -1;
+	return sm_send_ready(ss);
+}
+
+/*
+	compress one message, the 00 00 FF FF the sync flush ends with is dropped (RFC 7692 7.2.1)
+	@out: at least web_deflate_bound
+	return 0 and the length in @out_len, or -1 for error
+*/
+static int web_deflate_message(z_stream* strm, const char* data, uint32_t data_len, char* out, uint32_t out_cap, uint32_t* out_len) {
+	strm->next_in = (Bytef*)data;
+	strm->avail_in = data_len;
+	strm->next_out = (Bytef*)out;
+	strm->avail_out = out_cap;
+	if (deflate(strm, Z_SYNC_FLUSH) != Z_OK || strm->avail_in || strm->avail_out == 0)
+		return -1;
+
+	uint32_t len = out_cap - strm->avail_out;
+	if (len < sizeof(s_deflate_tail) || memcmp(out + len - sizeof(s_deflate_tail), s_deflate_tail, sizeof(s_deflate_tail)))
+		return -1;
+	*out_len = len - sizeof(s_deflate_tail);
+	return 0;
+}
+
+//room for the compressed message and the sync flush
+static uint64_t web_deflate_bound(z_stream* strm, uint32_t data_len) {
+	return (uint64_t)deflateBound(strm, data_len) + 16;
+}
+
+int web_protocol_send(struct sock_session* ss, const char* data, uint32_t data_len) {
+	//a client sends nothing before the upgrade completes (RFC 6455 4.1)
+	if (ss->web_client && ss->flag.bit_web_handshake == 0)
+		return -1;
+
+	unsigned char opcode = ss->flag.bit_proto_commu == PROTO_COMMU_WEBSOCKET_JSON ? 0x01 : 0x02;
+	web_deflate_t* wd = ss->web_deflate;
+	if (wd == 0 || data_len < wd->threshold)
+		return web_send_message(ss, opcode, data, data_len);
+
+	z_stream* strm = &wd->deflate;
+	if (wd->deflate_ready == 0) {
+		memset(strm, 0, sizeof(z_stream));
+		if (deflateInit2(strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -wd->server_bits, wd->mem_level, Z_DEFAULT_STRATEGY) != Z_OK)
+			return web_send_message(ss, opcode, data, data_len);
+		wd->deflate_ready = 1;
+	}
+	else if (wd->deflate_dirty) {
+		deflateReset(strm);
+	}
+	wd->deflate_dirty = 0;
+
+	uint64_t bound = web_deflate_bound(strm, data_len);
+	char* out = bound <= 0xFFFFFFFF ? netio_pool_alloc(ss->o_buf.pool, bound) : 0;
+	uint32_t out_len;
+	if (out == 0 || web_deflate_message(strm, data, data_len, out, bound, &out_len) || out_len >= data_len) {
+		//failed or incompressible, the peer never sees this context and an uncompressed frame is always allowed
+		deflateReset(strm);
+		if (out)
+			netio_pool_free(ss->o_buf.pool, out, bound);
+		return web_send_message(ss, opcode, data, data_len);
+	}
+	if (wd->server_reset)
+		deflateReset(strm);
+
+	int ret = web_send_message(ss, opcode | WEB_RSV1, out, out_len);
+	netio_pool_free(ss->o_buf.pool, out, bound);
+	return ret;
+}
+
+struct netio_shared* web_protocol_encode(struct netio_pool* pool, const char* data, uint32_t data_len, unsigned char opcode) {
 	struct ws_frame_protocol wfp;
 	memset(&wfp, 0, sizeof(wfp));
 	wfp.fin = 1;
 	wfp.mask = 0;
+	wfp.opcode = opcode;
 	wfp.payload_len = data_len;
 
-	if (ss->flag.bit_proto_commu == PROTO_COMMU_WEBSOCKET_JSON) {
-		wfp.opcode = 0x01;
+	char head[WEB_MAX_HEAD_LEN];
+	web_encode_protocol(head, &wfp);
+
+	netio_shared_t* sh = netio_shared_create(pool, wfp.head_len + data_len);
+	if (sh) {
+		memcpy(sh->data, head, wfp.head_len);
+		memcpy(sh->data + wfp.head_len, data, data_len);
 	}
-	else {
-		wfp.opcode = 0x02;
+	return sh;
+}
+
+struct netio_shared* web_protocol_encode_deflate(struct netio_pool* pool, const char* data, uint32_t data_len, unsigned char opcode, uint8_t window_bits) {
+	z_stream strm;
+	memset(&strm, 0, sizeof(strm));
+	if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -window_bits, WEB_DEFLATE_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+		return 0;
+
+	netio_shared_t* sh = 0;
+	uint64_t bound = web_deflate_bound(&strm, data_len);
+	char* out = bound <= 0xFFFFFFFF ? netio_pool_alloc(pool, bound) : 0;
+	uint32_t out_len;
+	if (out && web_deflate_message(&strm, data, data_len, out, bound, &out_len) == 0 && out_len < data_len) {
+		struct ws_frame_protocol wfp;
+		memset(&wfp, 0, sizeof(wfp));
+		wfp.fin = 1;
+		wfp.opcode = opcode | WEB_RSV1;
+		wfp.payload_len = out_len;
+
+		char head[WEB_MAX_HEAD_LEN];
+		web_encode_protocol(head, &wfp);
+
+		sh = netio_shared_create(pool, wfp.head_len + out_len);
+		if (sh) {
+			memcpy(sh->data, head, wfp.head_len);
+			memcpy(sh->data + wfp.head_len, out, out_len);
+		}
 	}
-	web_encode_protocol(ss->o_buf.send_buf + ss->o_buf.send_len, &wfp);
-	memcpy(ss->o_buf.send_buf + ss->o_buf.send_len + wfp.head_len, data, data_len);
-	ss->o_buf.send_len += (wfp.head_len + data_len);
+	if (out)
+		netio_pool_free(pool, out, bound);
+	deflateEnd(&strm);
+	//incompressible, the plain frame is shorter
+	if (sh == 0)
+		sh = web_protocol_encode(pool, data, data_len, opcode);
+	return sh;
+}
 
-	return sm_ep_add_event(ss->manager_ptr, ss, EPOLLOUT);
+uint8_t web_protocol_shared_deflate(struct sock_session* ss, uint32_t data_len) {
+	web_deflate_t* wd = ss->web_deflate;
+	if (wd == 0 || data_len < wd->threshold)
+		return 0;
+	wd->deflate_dirty = 1;
+	return wd->server_bits;
 }
 
-void web_protocol_ping(struct sock_session* ss) {
-	struct ws_frame_protocol wfp;
-	memset(&wfp, 0, sizeof(wfp));
-	wfp.fin = 1;
-	wfp.opcode = 0x09;
+void web_protocol_release(struct sock_session* ss) {
+	web_deflate_t* wd = ss->web_deflate;
+	if (wd) {
+		if (wd->deflate_ready)
+			deflateEnd(&wd->deflate);
+		if (wd->inflate_ready)
+			inflateEnd(&wd->inflate);
+		free(wd);
+		ss->web_deflate = 0;
+	}
+
+	if (ss->web_client) {
+		free(ss->web_client);
+		ss->web_client = 0;
+	}
+}
+
+/*
+	queue a control frame if it fits, it is dropped otherwise
+	return 0, or -1 not queued
+*/
+static int web_protocol_control(struct sock_session* ss, unsigned char opcode, const char* data, uint32_t data_len) {
+	if (netio_obuf_check_full(&ss->o_buf, WEB_MAX_HEAD_LEN + data_len))
+		return -1;
+	if (web_append_frame(ss, opcode, 1, data, data_len))
+		return -1;
+	return sm_send_ready(ss);
+}
 
-	web_encode_protocol(ss->o_buf.send_buf + ss->o_buf.send_len, &wfp);
-	ss->o_buf.send_len += wfp.head_len;
-	if (sm_ep_add_event(ss->manager_ptr, ss, EPOLLOUT) == 0) {
+void web_protocol_ping(struct sock_session* ss) {
+	//能容纳则写,否则放弃
+	if (web_protocol_control(ss, 0x09, 0, 0) == 0) {
 		ss->flag.bit_ping = 1;
 	}
-}
\ No newline at end of file
+}
+
+int web_protocol_client(struct sock_session* ss, const char* url) {
+	if (url == 0 || url[0] != '/' || strlen(url) > WEB_MAX_URL_LEN)
+		return -1;
+
+	web_client_t* wc = (web_client_t*)malloc(sizeof(web_client_t) + strlen(url) + 1);
+	if (wc == 0)
+		return -1;
+	memset(wc, 0, sizeof(web_client_t));
+	strcpy(wc->url, url);
+	ss->web_client = wc;
+	return 0;
+}
+
+int web_protocol_connect(struct sock_session* ss) {
+	web_client_t* wc = ss->web_client;
+	if (wc == 0)
+		return -1;
+
+	//nothing of the last connection is valid on the new one
+	ss->flag.bit_web_handshake = 0;
+	ss->flag.bit_ping = 0;
+	ss->web_frag_len = 0;
+	netio_ibuf_consume(&ss->i_buf, ss->i_buf.recv_len);
+	ss->i_buf.recv_idx = 0;
+	netio_obuf_destroy(&ss->o_buf);
+
+	//16 random bytes
+	uint64_t nonce[2];
+	char sec_key[32] = { 0 };
+	if (getrandom(nonce, sizeof(nonce), 0) != sizeof(nonce))
+		tools_get_random_id(nonce);
+	base64_encode((uint8_t*)nonce, sizeof(nonce), sec_key);
+	if (web_accept_key(sec_key, strlen(sec_key), wc->sec_accept))
+		return -1;
+
+	char req[WEB_MAX_URL_LEN + 256];
+	int req_len = sprintf(req, "GET %s HTTP/1.1\r\n" \
+		"Host: %s:%d\r\n" \
+		"Upgrade: websocket\r\n" \
+		"Connection: Upgrade\r\n" \
+		"Sec-WebSocket-Key: %s\r\n" \
+		"Sec-WebSocket-Version: 13\r\n" \
+		"\r\n", wc->url, ss->info.ip, ss->info.port, sec_key);
+
+	if (netio_obuf_check_full(&ss->o_buf, req_len) != 0 || netio_obuf_append(&ss->o_buf, req, req_len) != 0)
+		return -1;
+	return sm_send_ready(ss);
+}
@@ -10,13 +10,62 @@ extern "C"
 
 struct sock_session;
 struct session_manager;
+struct netio_pool;
+struct netio_shared;
+
+#define WEB_DEFLATE_MIN_BITS (9)			//zlib widens a raw window of 8 bits to 9, so 8 is never negotiated
+#define WEB_DEFLATE_MAX_BITS (15)
+
+/**
+*	web_deflate_conf_t - permessage-deflate (RFC 7692) of a listener, copied to the sessions it accepts
+*	@mem_cap: zlib memory of one session in bytes, the windows and the memory level are lowered to fit, 0 no cap
+*	@threshold: shorter messages are sent uncompressed
+*	@window_bits: window of our compressor, also asked of the client when it allows it, 0 disables the extension
+*	@no_context_takeover: both sides restart their compression context with every message (0/~0)
+*/
+typedef struct web_deflate_conf {
+	uint32_t	mem_cap;
+	uint32_t	threshold;
+	uint8_t		window_bits;
+	uint8_t		no_context_takeover;
+}web_deflate_conf_t;
 
 void web_protocol_recv(struct sock_session* ss);
 
-int web_protocol_send(struct sock_session* ss, const char* data, unsigned short data_len);
+//a message larger than the output buffer is streamed as continuation frames, see web_stream_message
+int web_protocol_send(struct sock_session* ss, const char* data, uint32_t data_len);
 
 void web_protocol_ping(struct sock_session* ss);
 
+//frame @data once for many sessions, @opcode 0x01 text or 0x02 binary
+struct netio_shared* web_protocol_encode(struct netio_pool* pool, const char* data, uint32_t data_len, unsigned char opcode);
+
+//compress and frame @data once for the sessions whose window is @window_bits, see web_protocol_shared_deflate
+struct netio_shared* web_protocol_encode_deflate(struct netio_pool* pool, const char* data, uint32_t data_len, unsigned char opcode, uint8_t window_bits);
+
+/*
+	window bits of the compressed shared frame @ss takes for a message of @data_len, 0 for the plain frame.
+	The shared frame has no context of the session, so the session restarts its own before its next message
+*/
+uint8_t web_protocol_shared_deflate(struct sock_session* ss, uint32_t data_len);
+
+/*
+	make the outbound session @ss a websocket client of @url (starts with '/'),
+	web_protocol_connect then starts the upgrade on every connection
+	return 0, or -1 for error
+*/
+int web_protocol_client(struct sock_session* ss, const char* url);
+
+/*
+	queue the upgrade request on a new connection of a client session, its frames are masked and
+	on_create_event_cb runs once the server accepts, sends before it fail
+	return 0, or -1 for error
+*/
+int web_protocol_connect(struct sock_session* ss);
+
+//free the compression and client state of @ss
+void web_protocol_release(struct sock_session* ss);
+
 #ifdef __cplusplus
 }
 #endif
@@ -14,6 +14,51 @@ const char* tools_get_uuid() {
 	return tools_get_uuid_r(uuid);
 }
 
+static uint64_t s_id_seed[2];
+static uint64_t s_id_counter;
+static pthread_once_t s_id_once = PTHREAD_ONCE_INIT;
+
+//finalizer of splitmix64, a bijection, distinct counters give distinct ids
+static uint64_t s_mix64(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	return x;
+}
+
+static void s_id_seed_init() {
+	uuid_t uu;
+	uuid_generate_random(uu);
+	memcpy(s_id_seed, uu, sizeof(s_id_seed));
+}
+
+void tools_get_fast_id(uint64_t id[2]) {
+	pthread_once(&s_id_once, s_id_seed_init);
+	uint64_t n = __atomic_fetch_add(&s_id_counter, 1, __ATOMIC_RELAXED);
+	id[0] = s_id_seed[0];
+	id[1] = s_mix64(n ^ s_id_seed[1]);
+}
+
+void tools_get_random_id(uint64_t id[2]) {
+	uuid_t uu;
+	uuid_generate_random(uu);
+	memcpy(id, uu, sizeof(uu));
+}
+
+const char* tools_format_id_r(const uint64_t id[2], char uuid_buf[40]) {
+	uuid_t uu;
+	memcpy(uu, id, sizeof(uu));
+	uuid_unparse_upper(uu, uuid_buf);
+	return uuid_buf;
+}
+
+unsigned int tools_hash_id(const uint64_t id[2]) {
+	uint64_t x = id[0] ^ id[1];
+	return (unsigned int)(x ^ (x >> 32));
+}
+
 unsigned int tools_hash_func(const char* char_key, int klen) {
 	unsigned int hash = 0;
 	const unsigned char* key = (const unsigned char*)char_key;
@@ -108,7 +153,8 @@ const char* tools_get_time_format_string() {
 	struct tm t;
 	localtime_r(&tv.tv_sec, &t);
 
-	static char time_fmt[64];
+	//one buffer per thread, each reactor thread logs on its own
+	static __thread char time_fmt[64];
 	sprintf(time_fmt, "%04d-%02d-%02d %02d:%02d:%02d.%06d",
 	//sprintf(time_fmt, "%04d-%02d-%02d %02d:%02d:%02d.%03d",
 		t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
@@ -10,6 +10,7 @@
 //Ҫlibuuid-devel
 #include <uuid/uuid.h>
 #include <errno.h>
+#include <pthread.h>
 
 #ifndef _WIN32
 #define __FILENAME__ (strrchr(__FILE__,'/') + 1)
@@ -29,6 +30,27 @@ const char* tools_get_uuid_r(char uuid_buf[40]);
 //
 const char* tools_get_uuid();
 
+/**
+*	tools_get_fast_id - 128 bit id without syscall: a per-process random seed (drawn on the first call) and a mixed atomic counter
+*	Unique inside the process, thread safe. A forked child shares the seed, call it only after the fork.
+*/
+void tools_get_fast_id(uint64_t id[2]);
+
+/**
+*	tools_get_random_id - 128 bit random id (one uuid_generate_random)
+*/
+void tools_get_random_id(uint64_t id[2]);
+
+/**
+*	tools_format_id_r - Format @id like tools_get_uuid_r, @uuid_buf not less than 37 bytes
+*/
+const char* tools_format_id_r(const uint64_t id[2], char uuid_buf[40]);
+
+/**
+*	tools_hash_id - 32 bit hash of an id of tools_get_fast_id or tools_get_random_id
+*/
+unsigned int tools_hash_id(const uint64_t id[2]);
+
 //hash
 unsigned int tools_hash_func(const char* char_key, int klen);
 
@@ -44,7 +66,7 @@ int tools_set_nonblocking(int fd);
 int tools_bit_range2(uint8_t left, uint8_t right, uint32_t num);
 
 /**
-*	tools_get_time_format_string - Gets the time format string of the current time, non-reentrant
+*	tools_get_time_format_string - Gets the time format string of the current time, non-reentrant (one buffer per thread)
 */
 const char* tools_get_time_format_string();
 
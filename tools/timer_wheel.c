@@ -0,0 +1,271 @@
+#include "timer_wheel.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define tw_malloc malloc
+#define tw_realloc realloc
+#define tw_free free
+
+#define TW_NIL				((uint32_t)-1)
+#define TW_ID_SHIFT			24
+#define TW_MAX_NODES		((1 << TW_ID_SHIFT) - 1)	//index 0xFFFFFF is never used, so no id equals -1
+#define TW_DEFAULT_NODES	(1 << 7)
+
+static uint64_t s_monotonic_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void s_link(timer_wheel_t* tw, uint32_t* head, uint32_t idx) {
+	tw_node_t* node = &tw->nodes[idx];
+	node->head = head;
+	node->prev = TW_NIL;
+	node->next = *head;
+	if (*head != TW_NIL)
+		tw->nodes[*head].prev = idx;
+	*head = idx;
+}
+
+static void s_unlink(timer_wheel_t* tw, uint32_t idx) {
+	tw_node_t* node = &tw->nodes[idx];
+	if (node->prev != TW_NIL)
+		tw->nodes[node->prev].next = node->next;
+	else
+		*node->head = node->next;
+	if (node->next != TW_NIL)
+		tw->nodes[node->next].prev = node->prev;
+	node->head = 0;
+}
+
+static void s_add_node(timer_wheel_t* tw, uint32_t idx) {
+	uint32_t expire = tw->nodes[idx].expire;
+	uint32_t current = tw->time;
+
+	if ((expire | TW_NEAR_MASK) == (current | TW_NEAR_MASK)) {
+		s_link(tw, &tw->near[expire & TW_NEAR_MASK], idx);
+		return;
+	}
+
+	//the first level whose range still holds the expire tick
+	int i;
+	uint32_t mask = TW_NEAR_SIZE << TW_LEVEL_SHIFT;
+	for (i = 0; i < TW_LEVEL_NUM - 1; ++i) {
+		if ((expire | (mask - 1)) == (current | (mask - 1)))
+			break;
+		mask <<= TW_LEVEL_SHIFT;
+	}
+	s_link(tw, &tw->level[i][(expire >> (TW_NEAR_SHIFT + i * TW_LEVEL_SHIFT)) & TW_LEVEL_MASK], idx);
+}
+
+static uint32_t s_alloc_node(timer_wheel_t* tw) {
+	if (tw->free_head == TW_NIL) {
+		if (tw->node_cap >= TW_MAX_NODES)
+			return TW_NIL;
+
+		uint32_t cap = tw->node_cap ? tw->node_cap << 1 : TW_DEFAULT_NODES;
+		if (cap > TW_MAX_NODES)
+			cap = TW_MAX_NODES;
+
+		tw_node_t* nodes = tw_realloc(tw->nodes, sizeof(tw_node_t) * cap);
+		if (nodes == 0)
+			return TW_NIL;
+		memset(nodes + tw->node_cap, 0, sizeof(tw_node_t) * (cap - tw->node_cap));
+
+		//new nodes go to the free list in index order
+		for (uint32_t i = cap; i > tw->node_cap; --i) {
+			nodes[i - 1].next = tw->free_head;
+			tw->free_head = i - 1;
+		}
+		tw->nodes = nodes;
+		tw->node_cap = cap;
+	}
+
+	uint32_t idx = tw->free_head;
+	tw->free_head = tw->nodes[idx].next;
+	return idx;
+}
+
+static void s_free_node(timer_wheel_t* tw, uint32_t idx) {
+	tw_node_t* node = &tw->nodes[idx];
+	node->gen += 1;
+	node->head = 0;
+	node->on_timeout = 0;
+	node->next = tw->free_head;
+	tw->free_head = idx;
+	tw->count -= 1;
+}
+
+static uint32_t s_node_id(timer_wheel_t* tw, uint32_t idx) {
+	return idx | ((uint32_t)tw->nodes[idx].gen << TW_ID_SHIFT);
+}
+
+//move one slot of a level back to the lower wheels
+static void s_move_list(timer_wheel_t* tw, int level, int slot) {
+	uint32_t idx = tw->level[level][slot];
+	tw->level[level][slot] = TW_NIL;
+	while (idx != TW_NIL) {
+		uint32_t next = tw->nodes[idx].next;
+		s_add_node(tw, idx);
+		idx = next;
+	}
+}
+
+static void s_shift(timer_wheel_t* tw) {
+	uint32_t mask = TW_NEAR_SIZE;
+	uint32_t ct = ++tw->time;
+	if (ct == 0) {
+		s_move_list(tw, TW_LEVEL_NUM - 1, 0);
+		return;
+	}
+
+	uint32_t time = ct >> TW_NEAR_SHIFT;
+	int i = 0;
+	while ((ct & (mask - 1)) == 0) {
+		int slot = time & TW_LEVEL_MASK;
+		if (slot != 0) {
+			s_move_list(tw, i, slot);
+			break;
+		}
+		mask <<= TW_LEVEL_SHIFT;
+		time >>= TW_LEVEL_SHIFT;
+		++i;
+	}
+}
+
+static void s_execute(timer_wheel_t* tw) {
+	uint32_t* slot = &tw->near[tw->time & TW_NEAR_MASK];
+	if (*slot == TW_NIL)
+		return;
+
+	//take the whole slot, timers added by the callbacks never land in the batch
+	tw->expired = *slot;
+	*slot = TW_NIL;
+	for (uint32_t idx = tw->expired; idx != TW_NIL; idx = tw->nodes[idx].next)
+		tw->nodes[idx].head = &tw->expired;
+
+	while (tw->expired != TW_NIL) {
+		uint32_t idx = tw->expired;
+		s_unlink(tw, idx);
+
+		tw->running = idx;
+		if (tw->nodes[idx].on_timeout)
+			tw->nodes[idx].on_timeout(s_node_id(tw, idx), tw->nodes[idx].user_data);
+		tw->running = TW_NIL;
+
+		//the callback may have grown the node array, take the pointer again
+		tw_node_t* node = &tw->nodes[idx];
+		if (node->repeat != -1 && (node->repeat -= 1) == 0) {
+			s_free_node(tw, idx);
+			continue;
+		}
+
+		node->expire = tw->time + (node->interval ? node->interval : 1);
+		s_add_node(tw, idx);
+	}
+}
+
+timer_wheel_t* tw_create_timer_wheel() {
+	timer_wheel_t* tw = tw_malloc(sizeof(timer_wheel_t));
+	if (tw) {
+		memset(tw, 0, sizeof(timer_wheel_t));
+		//TW_NIL is all bits set
+		memset(tw->near, 0xFF, sizeof(tw->near));
+		memset(tw->level, 0xFF, sizeof(tw->level));
+		tw->expired = TW_NIL;
+		tw->running = TW_NIL;
+		tw->free_head = TW_NIL;
+		tw->last_ms = s_monotonic_ms();
+	}
+	return tw;
+}
+
+void tw_destroy_timer_wheel(timer_wheel_t* tw) {
+	if (tw) {
+		if (tw->nodes)
+			tw_free(tw->nodes);
+		tw_free(tw);
+	}
+}
+
+uint32_t tw_add_timer(timer_wheel_t* tw, uint32_t interval_ms, uint32_t delay_ms, int32_t repeat, void(*on_timeout)(uint32_t, void*), void* user_data) {
+	if (tw == 0 || repeat == 0)
+		return -1;
+
+	uint32_t idx = s_alloc_node(tw);
+	if (idx == TW_NIL)
+		return -1;
+
+	//the loop may have slept past the current tick, count from the real clock
+	uint64_t ticks = s_monotonic_ms() - tw->last_ms + delay_ms + interval_ms;
+	if (ticks == 0)
+		ticks = 1;
+	else if (ticks > 0xFFFFFFFF)
+		ticks = 0xFFFFFFFF;
+
+	tw_node_t* node = &tw->nodes[idx];
+	node->expire = tw->time + (uint32_t)ticks;
+	node->interval = interval_ms;
+	node->repeat = repeat;
+	node->user_data = user_data;
+	node->on_timeout = on_timeout;
+	s_add_node(tw, idx);
+
+	tw->count += 1;
+	return s_node_id(tw, idx);
+}
+
+void tw_del_timer(timer_wheel_t* tw, uint32_t timer_id) {
+	if (tw == 0)
+		return;
+
+	uint32_t idx = timer_id & TW_MAX_NODES;
+	if (idx >= tw->node_cap || tw->nodes[idx].gen != (uint8_t)(timer_id >> TW_ID_SHIFT))
+		return;
+
+	/*if timer_id is equal to current running timer*/
+	if (idx == tw->running) {
+		tw->nodes[idx].repeat = 1;
+		return;
+	}
+
+	//not linked: already released
+	if (tw->nodes[idx].head == 0)
+		return;
+
+	s_unlink(tw, idx);
+	s_free_node(tw, idx);
+}
+
+uint32_t tw_update_timer(timer_wheel_t* tw) {
+	uint64_t cur_ms = s_monotonic_ms();
+
+	//nothing to cascade, jump to the clock at once
+	if (tw->count == 0) {
+		if (tw->last_ms < cur_ms) {
+			tw->time += (uint32_t)(cur_ms - tw->last_ms);
+			tw->last_ms = cur_ms;
+		}
+		return -1;
+	}
+
+	//one tick per elapsed millisecond
+	while (tw->last_ms < cur_ms) {
+		tw->last_ms += 1;
+		s_shift(tw);
+		s_execute(tw);
+	}
+
+	if (tw->count == 0)
+		return -1;
+
+	//next non-empty slot of the near wheel, or the next cascade
+	uint32_t slot = tw->time & TW_NEAR_MASK;
+	for (uint32_t i = slot + 1; i < TW_NEAR_SIZE; ++i) {
+		if (tw->near[i] != TW_NIL)
+			return i - slot;
+	}
+	return TW_NEAR_SIZE - slot;
+}
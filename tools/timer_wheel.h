@@ -0,0 +1,79 @@
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+	Hierarchical timing wheel, 1 tick = 1 ms
+	near wheel of 256 slots, then 4 levels of 64 slots, covers the whole uint32_t tick range.
+	Add and delete are O(1): a timer id carries the index of its node and a generation,
+	so deleting never searches. Expired timers of a tick are run as one batch.
+	Single thread only, like heap_timer in HT_SINGLE_THREAD_MOD.
+*/
+
+#define TW_NEAR_SHIFT	8
+#define TW_NEAR_SIZE	(1 << TW_NEAR_SHIFT)
+#define TW_NEAR_MASK	(TW_NEAR_SIZE - 1)
+#define TW_LEVEL_SHIFT	6
+#define TW_LEVEL_SIZE	(1 << TW_LEVEL_SHIFT)
+#define TW_LEVEL_MASK	(TW_LEVEL_SIZE - 1)
+#define TW_LEVEL_NUM	4
+
+typedef struct tw_node {
+	uint32_t prev;		//node index, TW_NIL for none
+	uint32_t next;
+	uint32_t* head;		//list the node is linked to, 0 if none
+	uint32_t expire;	//tick of the next timeout
+	uint32_t interval;
+	int32_t repeat;		//-1: unlimited
+	uint8_t gen;		//bumped on release, stale timer ids never match
+	void* user_data;
+	void(*on_timeout)(uint32_t, void*);
+}tw_node_t;
+
+typedef struct timer_wheel {
+	uint32_t near[TW_NEAR_SIZE];
+	uint32_t level[TW_LEVEL_NUM][TW_LEVEL_SIZE];
+	uint32_t expired;		//batch of the tick being run
+	uint32_t running;		//node in its callback, TW_NIL for none
+	uint32_t time;			//current tick
+	uint64_t last_ms;		//clock of the current tick
+	uint32_t count;			//active timers
+
+	tw_node_t* nodes;
+	uint32_t node_cap;
+	uint32_t free_head;
+}timer_wheel_t;
+
+timer_wheel_t* tw_create_timer_wheel();
+
+void tw_destroy_timer_wheel(timer_wheel_t* tw);
+
+/*
+	return value:
+	-1 failed;
+	other timer_id;
+*/
+uint32_t tw_add_timer(timer_wheel_t* tw, uint32_t interval_ms, uint32_t delay_ms, int32_t repeat, void(*on_timeout)(uint32_t, void*), void* user_data);
+
+/*
+	safe inside any timer callback, including the callback of @timer_id itself
+*/
+void tw_del_timer(timer_wheel_t* tw, uint32_t timer_id);
+
+/*
+	run the expired timers,
+	return the milliseconds to wait before the next call, -1 if there is no timer
+*/
+uint32_t tw_update_timer(timer_wheel_t* tw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//_TIMER_WHEEL_H_